@@ -0,0 +1,67 @@
+#ifndef ENGINE_STATE_H
+#define ENGINE_STATE_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "MemoryArena.h"
+#include "RenderCommands.h"
+
+// Engine interface structure - shared between main and every engine module.
+// Modules don't include SDL, so SDL types appear as their underlying types.
+struct SDL_Window;
+
+typedef struct {
+    // Persistent memory block that survives reloads
+    void* persistent_memory;
+    size_t persistent_memory_size;
+
+    // Frame memory, handed out by frame_arena and rewound every frame.
+    // Contents are not cleared; push with the _zero variants if needed.
+    void* frame_memory;
+    size_t frame_memory_size;
+    MemoryArena frame_arena;
+
+    // This frame's render commands, in frame memory. Render phases record
+    // into it and main.c sorts and executes it after the last module.
+    RenderCommandBuffer render_commands;
+
+    // Platform services that modules can use
+    struct SDL_Window* window;
+    void* gl_context;
+    // False for headless runs without OpenGL; modules must not call GL then
+    bool has_gpu;
+    // Unique per process. Persistent memory can outlive the process (see
+    // --state-file), so GL handles stored there are only valid while the
+    // session that created them matches.
+    uint64_t session_id;
+
+    // Shader programs compiled by main.c
+    unsigned int basic_shader_program;
+
+    // Timing info
+    float delta_time;
+    float total_time;
+
+    // Input state, indexed by SDL scancode
+    const bool* keyboard_state;
+    float mouse_x, mouse_y;
+    uint32_t mouse_buttons;
+
+    // Window dimensions
+    int window_width;
+    int window_height;
+
+    // Control flags
+    bool should_quit;
+    bool is_reloaded;
+    bool is_shutting_down;
+} EngineState;
+
+// Every module is a shared library exporting <module>_init and
+// <module>_cleanup, plus <module>_update and <module>_render if it takes part
+// in those phases. main.c calls each phase on the modules in table order.
+typedef void (*module_init_func)(EngineState* state);
+typedef void (*module_update_func)(EngineState* state);
+typedef void (*module_render_func)(EngineState* state);
+typedef void (*module_cleanup_func)(EngineState* state);
+#endif
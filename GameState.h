@@ -1,12 +1,125 @@
 #ifndef GAME_STATE
 #define GAME_STATE
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "MemoryMap.h"
+
+// Game state that persists across reloads. Fields are listed once here and
+// expanded into both the struct and a layout descriptor, so a reloaded engine
+// can migrate the previous block by field name after fields are added,
+// removed, reordered or retyped.
+//
+// X(type, kind, name, default value)
+#define GAME_STATE_FIELDS(X) \
+    X(bool,         BOOL,  initialized,     false) \
+    X(float,        FLOAT, player_x,        0.0f) \
+    X(float,        FLOAT, player_y,        0.0f) \
+    X(float,        FLOAT, player_rotation, 0.0f) \
+    X(float,        FLOAT, player_speed,    200.0f) \
+    X(unsigned int, UINT,  vao,             0) \
+    X(unsigned int, UINT,  vbo,             0) \
+    X(int,          INT,   reload_count,    0) \
+    X(float,        FLOAT, color_r,         1.0f) \
+    X(float,        FLOAT, color_g,         0.5f) \
+    X(float,        FLOAT, color_b,         0.0f) \
+    X(int,          INT,   sprite_count,    0)
+
 typedef struct {
-    bool initialized;
-    float player_x, player_y;
-    float player_rotation;
-    float player_speed;
-    unsigned int vao, vbo;
-    int reload_count;
-    float color_r, color_g, color_b;
+#define GAME_STATE_DECLARE_FIELD(field_type, field_kind, field_name, field_default) field_type field_name;
+    GAME_STATE_FIELDS(GAME_STATE_DECLARE_FIELD)
+#undef GAME_STATE_DECLARE_FIELD
 } GameState;
-#endif
\ No newline at end of file
+
+typedef enum {
+    GAME_FIELD_BOOL,
+    GAME_FIELD_INT,
+    GAME_FIELD_UINT,
+    GAME_FIELD_FLOAT
+} GameFieldKind;
+
+typedef struct {
+    char name[32];
+    uint32_t offset;
+    uint32_t size;
+    uint32_t kind;
+} GameStateField;
+
+#define GAME_STATE_LAYOUT_MAGIC 0x47534C31u
+#define GAME_STATE_MAX_FIELDS 128
+
+// Stored in front of the GameState it describes
+typedef struct {
+    uint32_t magic;
+    uint32_t state_size;
+    uint32_t field_count;
+    GameStateField fields[GAME_STATE_MAX_FIELDS];
+} GameStateLayout;
+
+typedef char game_state_layout_fits[(sizeof(GameStateLayout) <= GAME_STATE_OFFSET) ? 1 : -1];
+typedef char game_state_fits[(sizeof(GameState) <= GAME_STATE_CAPACITY) ? 1 : -1];
+
+static inline GameStateLayout* game_state_layout(void* persistent_memory) {
+    return (GameStateLayout*)((char*)persistent_memory + GAME_STATE_LAYOUT_OFFSET);
+}
+
+static inline GameState* game_state(void* persistent_memory) {
+    return (GameState*)((char*)persistent_memory + GAME_STATE_OFFSET);
+}
+
+// Gameplay data that grows and shrinks at run time lives in the persistent
+// heap and is found again by pool name after a reload. The level is a
+// singleton pool created before the level's heap mark, so releasing the
+// level back to the mark keeps it; the trail pool and the list of live
+// trail points come after the mark and go with the level.
+#define GAME_LEVEL_POOL "game_level"
+#define GAME_TRAIL_POOL "trail_points"
+#define GAME_TRAIL_CAPACITY 512
+// Seconds a trail point lasts
+#define GAME_TRAIL_LIFETIME 6.0f
+
+typedef struct {
+    float x, y;
+    float age;
+} TrailPoint;
+
+typedef struct {
+    PersistentHeapMark mark;
+    // Size class block of trail_capacity offsets of live TrailPoints,
+    // oldest first
+    PersistentOffset trail;
+    uint32_t trail_count;
+    uint32_t trail_capacity;
+    // Where the last trail point was dropped
+    float last_x, last_y;
+} GameLevel;
+
+// The current level, or NULL before the engine has started one
+static inline GameLevel* game_level(PersistentHeap* heap) {
+    PersistentPool* pool = heap ? persistent_pool_find(heap, GAME_LEVEL_POOL) : NULL;
+    return pool && pool->live_count ? PERSISTENT_PTR(heap, GameLevel, pool->elements) : NULL;
+}
+
+// Describe the GameState this translation unit was compiled against
+static inline void game_state_describe(GameStateLayout* layout) {
+    memset(layout, 0, sizeof(*layout));
+    layout->magic = GAME_STATE_LAYOUT_MAGIC;
+    layout->state_size = sizeof(GameState);
+#define GAME_STATE_DESCRIBE_FIELD(field_type, field_kind, field_name, field_default) { \
+        GameStateField* field = &layout->fields[layout->field_count++]; \
+        strncpy(field->name, #field_name, sizeof(field->name) - 1); \
+        field->offset = offsetof(GameState, field_name); \
+        field->size = sizeof(field_type); \
+        field->kind = GAME_FIELD_##field_kind; \
+    }
+    GAME_STATE_FIELDS(GAME_STATE_DESCRIBE_FIELD)
+#undef GAME_STATE_DESCRIBE_FIELD
+}
+
+static inline void game_state_set_defaults(GameState* game) {
+#define GAME_STATE_DEFAULT_FIELD(field_type, field_kind, field_name, field_default) game->field_name = field_default;
+    GAME_STATE_FIELDS(GAME_STATE_DEFAULT_FIELD)
+#undef GAME_STATE_DEFAULT_FIELD
+}
+#endif
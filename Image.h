@@ -0,0 +1,273 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "MemoryArena.h"
+
+// Image files for the asset pipeline: uncompressed 24/32-bit BMP and
+// 24/32-bit TGA, raw or run-length encoded. Decoded images are RGBA, 8 bits
+// per channel with red in the lowest byte, rows top to bottom, which is the
+// layout glTexImage2D takes with GL_RGBA / GL_UNSIGNED_BYTE. Pixels are
+// pushed to an arena, so images loaded for a frame or a load step go away
+// with it.
+
+// Largest width or height accepted, so a corrupt header can't ask for an
+// absurd allocation
+#define IMAGE_MAX_DIMENSION 16384
+
+typedef struct {
+    int width;
+    int height;
+    uint32_t* pixels;
+} Image;
+
+static inline uint32_t image_read_u16(const unsigned char* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8;
+}
+
+static inline uint32_t image_read_u32(const unsigned char* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline uint32_t image_rgba(uint32_t r, uint32_t g, uint32_t b, uint32_t a) {
+    return r | g << 8 | b << 16 | a << 24;
+}
+
+// Scale the bits of `value` selected by `mask` to 0..255; 255 for no mask
+static inline uint32_t image_mask_channel(uint32_t value, uint32_t mask) {
+    if (!mask) {
+        return 255;
+    }
+    int shift = 0;
+    while (!(mask & (1u << shift))) {
+        shift++;
+    }
+    uint32_t max = mask >> shift;
+    return (uint32_t)(((uint64_t)((value & mask) >> shift) * 255 + max / 2) / max);
+}
+
+static inline bool image_allocate(Image* image, int width, int height, MemoryArena* arena) {
+    if (width <= 0 || height <= 0 || width > IMAGE_MAX_DIMENSION || height > IMAGE_MAX_DIMENSION) {
+        printf("Image size %dx%d not supported\n", width, height);
+        return false;
+    }
+    image->width = width;
+    image->height = height;
+    image->pixels = arena_push_array(arena, uint32_t, (size_t)width * height, MEMORY_TAG_RENDER);
+    return image->pixels != NULL;
+}
+
+static inline bool image_decode_bmp(const unsigned char* data, size_t size, Image* image, MemoryArena* arena) {
+    if (size < 54 || data[0] != 'B' || data[1] != 'M') {
+        return false;
+    }
+    uint32_t pixel_offset = image_read_u32(data + 10);
+    uint32_t header_size = image_read_u32(data + 14);
+    int32_t width = (int32_t)image_read_u32(data + 18);
+    int32_t height = (int32_t)image_read_u32(data + 22);
+    uint32_t bits = image_read_u16(data + 28);
+    uint32_t compression = image_read_u32(data + 30);
+
+    // BI_RGB, or BI_BITFIELDS with the masks after a 40-byte header or
+    // inside a V4/V5 one
+    uint32_t masks[4] = { 0x00FF0000u, 0x0000FF00u, 0x000000FFu, bits == 32 ? 0xFF000000u : 0 };
+    if (compression == 3 && bits == 32 && 14 + header_size + (header_size == 40 ? 12 : 0) <= size) {
+        for (int i = 0; i < 3; i++) {
+            masks[i] = image_read_u32(data + 54 + i * 4);
+        }
+        masks[3] = header_size >= 56 ? image_read_u32(data + 66) : 0;
+    } else if (compression != 0 || (bits != 24 && bits != 32)) {
+        printf("BMP: only uncompressed 24 and 32 bit images are supported (%u bits, compression %u)\n", bits, compression);
+        return false;
+    }
+
+    // Negative height means rows are stored top to bottom
+    bool top_down = height < 0;
+    int rows = top_down ? -height : height;
+    if (width <= 0 || rows <= 0 || width > IMAGE_MAX_DIMENSION || rows > IMAGE_MAX_DIMENSION) {
+        printf("BMP: image size %dx%d not supported\n", width, rows);
+        return false;
+    }
+    size_t stride = ((size_t)width * bits / 8 + 3) & ~(size_t)3;
+    if (pixel_offset > size || stride * rows > size - pixel_offset) {
+        printf("BMP: file is truncated\n");
+        return false;
+    }
+    if (!image_allocate(image, width, rows, arena)) {
+        return false;
+    }
+
+    // 32-bit files often leave alpha zero everywhere; those are opaque
+    bool any_alpha = false;
+    for (int y = 0; y < rows; y++) {
+        const unsigned char* src = data + pixel_offset + stride * (size_t)(top_down ? y : rows - 1 - y);
+        uint32_t* dst = image->pixels + (size_t)y * width;
+        for (int x = 0; x < width; x++) {
+            if (bits == 24) {
+                dst[x] = image_rgba(src[2], src[1], src[0], 255);
+                src += 3;
+            } else {
+                uint32_t value = image_read_u32(src);
+                uint32_t alpha = image_mask_channel(value, masks[3]);
+                any_alpha |= masks[3] && alpha != 0;
+                dst[x] = image_rgba(image_mask_channel(value, masks[0]), image_mask_channel(value, masks[1]),
+                                    image_mask_channel(value, masks[2]), alpha);
+                src += 4;
+            }
+        }
+    }
+    if (bits == 32 && !any_alpha) {
+        for (size_t i = 0; i < (size_t)width * rows; i++) {
+            image->pixels[i] |= 0xFF000000u;
+        }
+    }
+    return true;
+}
+
+static inline bool image_decode_tga(const unsigned char* data, size_t size, Image* image, MemoryArena* arena) {
+    if (size < 18) {
+        return false;
+    }
+    uint32_t id_length = data[0];
+    uint32_t color_map_type = data[1];
+    uint32_t image_type = data[2];
+    uint32_t color_map_bytes = color_map_type ? image_read_u16(data + 5) * ((data[7] + 7) / 8) : 0;
+    int width = (int)image_read_u16(data + 12);
+    int height = (int)image_read_u16(data + 14);
+    uint32_t bits = data[16];
+    // Bit 5 of the descriptor: rows are stored top to bottom
+    bool top_down = (data[17] & 0x20) != 0;
+
+    // 2 is raw true color, 10 the same run-length encoded
+    if ((image_type != 2 && image_type != 10) || (bits != 24 && bits != 32)) {
+        printf("TGA: only 24 and 32 bit true color images are supported (type %u, %u bits)\n", image_type, bits);
+        return false;
+    }
+    size_t offset = 18 + id_length + color_map_bytes;
+    if (offset > size) {
+        printf("TGA: file is truncated\n");
+        return false;
+    }
+    if (!image_allocate(image, width, height, arena)) {
+        return false;
+    }
+
+    uint32_t pixel_bytes = bits / 8;
+    size_t count = (size_t)width * height;
+    size_t i = 0;
+    while (i < count) {
+        // A raw file is one long literal packet
+        size_t run = count - i;
+        bool repeat = false;
+        if (image_type == 10) {
+            if (offset >= size) {
+                break;
+            }
+            uint32_t packet = data[offset++];
+            run = (packet & 0x7F) + 1;
+            repeat = (packet & 0x80) != 0;
+            if (run > count - i) {
+                run = count - i;
+            }
+        }
+        size_t needed = (repeat ? 1 : run) * pixel_bytes;
+        if (needed > size - offset) {
+            break;
+        }
+        for (size_t j = 0; j < run; j++, i++) {
+            const unsigned char* src = data + offset + (repeat ? 0 : j * pixel_bytes);
+            size_t y = i / width;
+            size_t x = i % width;
+            size_t row = top_down ? y : (size_t)height - 1 - y;
+            image->pixels[row * width + x] = image_rgba(src[2], src[1], src[0], pixel_bytes == 4 ? src[3] : 255);
+        }
+        offset += needed;
+    }
+    if (i < count) {
+        printf("TGA: file is truncated\n");
+        return false;
+    }
+    return true;
+}
+
+// Decode a BMP or TGA file already in memory. TGA has no signature, so
+// anything that isn't a BMP is tried as one.
+static inline bool image_decode(const unsigned char* data, size_t size, Image* image, MemoryArena* arena) {
+    memset(image, 0, sizeof(*image));
+    if (size >= 2 && data[0] == 'B' && data[1] == 'M') {
+        return image_decode_bmp(data, size, image, arena);
+    }
+    return image_decode_tga(data, size, image, arena);
+}
+
+// Load an image file. Only the pixels stay in the arena; the file contents
+// are read into it and dropped again.
+static inline bool image_load(const char* path, Image* image, MemoryArena* arena) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        printf("Failed to open image %s\n", path);
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    ArenaMarker marker = arena_begin_temp(arena);
+    unsigned char* data = size > 0 ? arena_push(arena, (size_t)size, MEMORY_TAG_SCRATCH) : NULL;
+    bool ok = data && fread(data, 1, (size_t)size, file) == (size_t)size && image_decode(data, (size_t)size, image, arena);
+    fclose(file);
+    if (!ok) {
+        printf("Failed to load image %s\n", path);
+        arena_end_temp(marker);
+        return false;
+    }
+
+    // Slide the pixels down over the file data
+    size_t pixel_bytes = (size_t)image->width * image->height * sizeof(uint32_t);
+    arena_end_temp(marker);
+    uint32_t* pixels = arena_push_array(arena, uint32_t, (size_t)image->width * image->height, MEMORY_TAG_RENDER);
+    memmove(pixels, image->pixels, pixel_bytes);
+    image->pixels = pixels;
+    return true;
+}
+
+// Write an uncompressed 32-bit TGA, rows top to bottom
+static inline bool image_write_tga(const char* path, const Image* image) {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        printf("Failed to create %s\n", path);
+        return false;
+    }
+    unsigned char header[18] = {0};
+    header[2] = 2;
+    header[12] = (unsigned char)(image->width & 0xFF);
+    header[13] = (unsigned char)(image->width >> 8);
+    header[14] = (unsigned char)(image->height & 0xFF);
+    header[15] = (unsigned char)(image->height >> 8);
+    header[16] = 32;
+    header[17] = 0x20 | 8;
+    bool ok = fwrite(header, sizeof(header), 1, file) == 1;
+
+    unsigned char row[4 * IMAGE_MAX_DIMENSION];
+    for (int y = 0; ok && y < image->height; y++) {
+        const uint32_t* src = image->pixels + (size_t)y * image->width;
+        for (int x = 0; x < image->width; x++) {
+            row[x * 4 + 0] = (unsigned char)(src[x] >> 16);
+            row[x * 4 + 1] = (unsigned char)(src[x] >> 8);
+            row[x * 4 + 2] = (unsigned char)src[x];
+            row[x * 4 + 3] = (unsigned char)(src[x] >> 24);
+        }
+        ok = fwrite(row, 4, (size_t)image->width, file) == (size_t)image->width;
+    }
+    if (fclose(file) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        printf("Failed to write %s\n", path);
+    }
+    return ok;
+}
+#endif
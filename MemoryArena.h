@@ -0,0 +1,147 @@
+#ifndef MEMORY_ARENA_H
+#define MEMORY_ARENA_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "MemoryStats.h"
+#include "VirtualMemory.h"
+
+// Bump-pointer allocator over a fixed block. Allocations are never freed one
+// by one: the whole arena is rewound at once, or back to a temp marker.
+// Memory is not cleared; use the _zero variants where a caller relies on it.
+// Every push is tagged with the subsystem it is for; see MemoryStats.h.
+typedef struct {
+    unsigned char* base;
+    size_t size;
+    size_t used;
+    // Largest `used` seen since the arena was set up
+    size_t peak;
+    // Bytes from `base` that are usable. Equal to `size` for an ordinary
+    // block; an arena over reserved address space (see VirtualMemory.h)
+    // commits in steps of `commit_granularity` as pushes reach the end.
+    size_t committed;
+    size_t commit_granularity;
+    MemoryTagStats tags[MEMORY_TAG_COUNT];
+} MemoryArena;
+
+// Position to rewind to, for scratch allocations inside a larger scope
+typedef struct {
+    MemoryArena* arena;
+    size_t used;
+} ArenaMarker;
+
+#define ARENA_DEFAULT_ALIGNMENT 16
+#define ARENA_ALIGNOF(type) offsetof(struct { char c; type member; }, member)
+
+static inline void arena_init(MemoryArena* arena, void* memory, size_t size) {
+    arena->base = (unsigned char*)memory;
+    arena->size = size;
+    arena->used = 0;
+    arena->peak = 0;
+    arena->committed = size;
+    arena->commit_granularity = 0;
+    memset(arena->tags, 0, sizeof(arena->tags));
+}
+
+// Arena over `size` bytes of reserved, uncommitted address space.
+// `granularity` must be a multiple of the page size.
+static inline void arena_init_reserved(MemoryArena* arena, void* memory, size_t size, size_t granularity) {
+    arena_init(arena, memory, size);
+    arena->committed = 0;
+    arena->commit_granularity = granularity;
+}
+
+// Grow the committed part to cover the first `bytes` bytes
+static inline bool arena_commit(MemoryArena* arena, size_t bytes) {
+    size_t target = (size_t)vm_align_up(bytes, arena->commit_granularity);
+    if (target > arena->size) {
+        target = arena->size;
+    }
+    if (target <= arena->committed) {
+        return true;
+    }
+    if (!vm_commit(arena->base + arena->committed, target - arena->committed)) {
+        return false;
+    }
+    arena->committed = target;
+    return true;
+}
+
+// Return committed pages past the current position to the kernel, e.g.
+// after a level is unloaded. Only for arenas over reserved memory.
+static inline void arena_decommit(MemoryArena* arena) {
+    if (!arena->commit_granularity) {
+        return;
+    }
+    size_t keep = (size_t)vm_align_up(arena->used, arena->commit_granularity);
+    if (keep < arena->committed) {
+        vm_decommit(arena->base + keep, arena->committed - keep);
+        arena->committed = keep;
+    }
+}
+
+// `alignment` must be a power of two. Returns NULL when the arena is full.
+static inline void* arena_push_aligned(MemoryArena* arena, size_t size, size_t alignment, MemoryTag tag) {
+    uintptr_t address = (uintptr_t)arena->base + arena->used;
+    size_t padding = (size_t)(-address & (alignment - 1));
+    if (size > arena->size - arena->used || padding > arena->size - arena->used - size) {
+        printf("Arena out of memory: %zu bytes requested for %s, %zu of %zu used\n",
+               size, memory_tag_name(tag), arena->used, arena->size);
+        return NULL;
+    }
+
+    if (arena->used + padding + size > arena->committed && !arena_commit(arena, arena->used + padding + size)) {
+        return NULL;
+    }
+
+    void* result = arena->base + arena->used + padding;
+    arena->used += padding + size;
+    if (arena->used > arena->peak) {
+        arena->peak = arena->used;
+    }
+    memory_stats_add(arena->tags, tag, padding + size);
+    return result;
+}
+
+static inline void* arena_push(MemoryArena* arena, size_t size, MemoryTag tag) {
+    return arena_push_aligned(arena, size, ARENA_DEFAULT_ALIGNMENT, tag);
+}
+
+static inline void* arena_push_zero(MemoryArena* arena, size_t size, MemoryTag tag) {
+    void* result = arena_push(arena, size, tag);
+    if (result) {
+        memset(result, 0, size);
+    }
+    return result;
+}
+
+#define arena_push_struct(arena, type, tag) \
+    ((type*)arena_push_aligned((arena), sizeof(type), ARENA_ALIGNOF(type), (tag)))
+#define arena_push_array(arena, type, count, tag) \
+    ((type*)arena_push_aligned((arena), sizeof(type) * (size_t)(count), ARENA_ALIGNOF(type), (tag)))
+#define arena_push_array_zero(arena, type, count, tag) \
+    ((type*)arena_push_zero((arena), sizeof(type) * (size_t)(count), (tag)))
+
+static inline ArenaMarker arena_begin_temp(MemoryArena* arena) {
+    ArenaMarker marker = { arena, arena->used };
+    return marker;
+}
+
+static inline void arena_end_temp(ArenaMarker marker) {
+    marker.arena->used = marker.used;
+}
+
+// Temp scopes hand their bytes back, but per tag counters only restart at
+// reset, so they report everything pushed during the frame.
+//
+// O(1) in the arena size: nothing is touched, the next push just starts at
+// the beginning again
+static inline void arena_reset(MemoryArena* arena) {
+    arena->used = 0;
+    for (int tag = 0; tag < MEMORY_TAG_COUNT; tag++) {
+        arena->tags[tag].current_bytes = 0;
+        arena->tags[tag].allocations = 0;
+    }
+}
+#endif
@@ -0,0 +1,43 @@
+#ifndef MEMORY_MAP_H
+#define MEMORY_MAP_H
+#include <stddef.h>
+#include "PersistentHeap.h"
+
+// Persistent memory map: layout descriptor, the GameState with room to grow,
+// the renderer's GPU resource registry, then the persistent heap up to the
+// end of the block. Kept apart from GameState.h so the platform layer can
+// find the heap without depending on the game's fields.
+#define GAME_STATE_LAYOUT_OFFSET 0
+#define GAME_STATE_OFFSET        (8 * 1024)
+#define GAME_STATE_CAPACITY      (56 * 1024)
+#define GAME_STATE_END           (GAME_STATE_OFFSET + GAME_STATE_CAPACITY)
+#define GPU_REGISTRY_OFFSET      GAME_STATE_END
+#define GPU_REGISTRY_CAPACITY    (64 * 1024)
+#define GPU_REGISTRY_END         (GPU_REGISTRY_OFFSET + GPU_REGISTRY_CAPACITY)
+#define PERSISTENT_HEAP_OFFSET   GPU_REGISTRY_END
+
+// The block is reserved address space. The platform layer commits this much
+// up front, covering the fixed regions and the heap header; the heap
+// commits the rest as it grows.
+#define PERSISTENT_MEMORY_INITIAL_COMMIT (2 * 1024 * 1024)
+
+typedef char persistent_heap_header_committed[(PERSISTENT_HEAP_OFFSET + sizeof(PersistentHeap) <= PERSISTENT_MEMORY_INITIAL_COMMIT) ? 1 : -1];
+
+static inline PersistentHeap* persistent_heap(void* persistent_memory, size_t persistent_memory_size) {
+    return persistent_heap_attach((char*)persistent_memory + PERSISTENT_HEAP_OFFSET,
+                                  persistent_memory_size - PERSISTENT_HEAP_OFFSET);
+}
+
+// The heap if a module has set one up, without creating it; for reporting
+static inline PersistentHeap* persistent_heap_find(void* persistent_memory) {
+    PersistentHeap* heap = (PersistentHeap*)((char*)persistent_memory + PERSISTENT_HEAP_OFFSET);
+    return heap->magic == PERSISTENT_HEAP_MAGIC ? heap : NULL;
+}
+
+// Bytes from the start of the block that are committed
+static inline size_t persistent_memory_committed(void* persistent_memory) {
+    PersistentHeap* heap = persistent_heap_find(persistent_memory);
+    size_t committed = heap ? PERSISTENT_HEAP_OFFSET + heap->committed : 0;
+    return committed > PERSISTENT_MEMORY_INITIAL_COMMIT ? committed : PERSISTENT_MEMORY_INITIAL_COMMIT;
+}
+#endif
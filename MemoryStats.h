@@ -0,0 +1,57 @@
+#ifndef MEMORY_STATS_H
+#define MEMORY_STATS_H
+#include <stdint.h>
+
+// Every allocation from frame or persistent memory names the subsystem it
+// belongs to, and each allocator keeps these counters per tag so budgets can
+// be sized from data. Tags are appended, never reordered: persistent
+// counters are stored by index.
+//
+// X(enum suffix, display name)
+#define MEMORY_TAGS(X) \
+    X(UNTAGGED,  "untagged") \
+    X(MIGRATION, "migration") \
+    X(GAMEPLAY,  "gameplay") \
+    X(RENDER,    "render") \
+    X(SCRATCH,   "scratch")
+
+typedef enum {
+#define MEMORY_TAG_ENUM(tag_id, tag_name) MEMORY_TAG_##tag_id,
+    MEMORY_TAGS(MEMORY_TAG_ENUM)
+#undef MEMORY_TAG_ENUM
+    MEMORY_TAG_COUNT
+} MemoryTag;
+
+// For the frame arena `current_bytes` and `allocations` cover the current
+// frame and restart at every reset; `peak_bytes` is the worst frame seen.
+typedef struct {
+    uint64_t current_bytes;
+    uint64_t peak_bytes;
+    uint32_t allocations;
+    uint32_t frees;
+} MemoryTagStats;
+
+static inline const char* memory_tag_name(int tag) {
+    switch (tag) {
+#define MEMORY_TAG_NAME(tag_id, tag_name) case MEMORY_TAG_##tag_id: return tag_name;
+        MEMORY_TAGS(MEMORY_TAG_NAME)
+#undef MEMORY_TAG_NAME
+        default: return "unknown";
+    }
+}
+
+static inline void memory_stats_add(MemoryTagStats* stats, MemoryTag tag, uint64_t bytes) {
+    MemoryTagStats* entry = &stats[(unsigned)tag < MEMORY_TAG_COUNT ? tag : MEMORY_TAG_UNTAGGED];
+    entry->current_bytes += bytes;
+    entry->allocations++;
+    if (entry->current_bytes > entry->peak_bytes) {
+        entry->peak_bytes = entry->current_bytes;
+    }
+}
+
+static inline void memory_stats_remove(MemoryTagStats* stats, MemoryTag tag, uint64_t bytes) {
+    MemoryTagStats* entry = &stats[(unsigned)tag < MEMORY_TAG_COUNT ? tag : MEMORY_TAG_UNTAGGED];
+    entry->current_bytes -= bytes < entry->current_bytes ? bytes : entry->current_bytes;
+    entry->frees++;
+}
+#endif
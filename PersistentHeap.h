@@ -0,0 +1,437 @@
+#ifndef PERSISTENT_HEAP_H
+#define PERSISTENT_HEAP_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "hash.h"
+#include "MemoryStats.h"
+#include "VirtualMemory.h"
+
+// Allocators that live inside persistent memory and survive reloads:
+//  - a bump region for data that is never freed,
+//  - named fixed-size pools with intrusive free lists,
+//  - power of two size classes for everything else.
+// All bookkeeping is stored in the heap itself as offsets from its header,
+// with no pointers or function pointers, so a freshly loaded module picks up
+// exactly where the previous one left off. Offset 0 is the null offset.
+// Allocations are tagged and counted per tag in the header.
+//
+// The heap may span reserved address space: it commits in
+// PERSISTENT_HEAP_COMMIT_GRANULARITY steps as the bump region grows, so
+// memory past `committed` faults when touched. The caller must have
+// committed the header before attaching.
+
+// Changes whenever the header layout does, so a heap kept in a state file by
+// an older build is reset instead of misread
+#define PERSISTENT_HEAP_MAGIC 0x50484533u
+#define PERSISTENT_HEAP_ALIGNMENT 16
+#define PERSISTENT_HEAP_MAX_POOLS 64
+#define PERSISTENT_SIZE_CLASS_MIN_SHIFT 4  // 16 bytes
+#define PERSISTENT_SIZE_CLASS_COUNT 13     // up to 64KB
+#define PERSISTENT_BLOCK_MAGIC 0x424C4B31u
+// Huge page sized, so committed memory can be backed by huge pages
+#define PERSISTENT_HEAP_COMMIT_GRANULARITY (2 * 1024 * 1024)
+
+typedef uint64_t PersistentOffset;
+
+typedef struct {
+    uint64_t name_hash;
+    uint32_t element_size;
+    uint32_t capacity;
+    uint32_t live_count;
+    uint32_t tag;
+    PersistentOffset elements;
+    PersistentOffset free_head;
+} PersistentPool;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t pool_count;
+    uint64_t size;
+    uint64_t used;
+    // Bytes from the header that are committed
+    uint64_t committed;
+    // Set by the platform while it write-protects the committed pages to
+    // track changes (see snapshot.h); releasing memory then keeps them
+    // committed, as decommitting and recommitting would unprotect them
+    uint32_t keep_committed;
+    uint32_t unused;
+    // Largest `used` seen, which persistent_heap_release doesn't lower
+    uint64_t peak;
+    PersistentOffset size_class_free[PERSISTENT_SIZE_CLASS_COUNT];
+    PersistentPool pools[PERSISTENT_HEAP_MAX_POOLS];
+    MemoryTagStats tags[MEMORY_TAG_COUNT];
+} PersistentHeap;
+
+// Heap position to roll back to; see persistent_heap_release
+typedef struct {
+    uint64_t used;
+    uint32_t pool_count;
+    uint64_t tag_bytes[MEMORY_TAG_COUNT];
+} PersistentHeapMark;
+
+// Precedes every size class block so persistent_free knows its class
+typedef struct {
+    uint32_t magic;
+    uint32_t size_class;
+    uint32_t tag;
+    uint32_t unused;
+} PersistentBlockHeader;
+
+static inline void* persistent_ptr(PersistentHeap* heap, PersistentOffset offset) {
+    return offset ? (char*)heap + offset : NULL;
+}
+
+static inline PersistentOffset persistent_offset(PersistentHeap* heap, const void* ptr) {
+    return ptr ? (PersistentOffset)((const char*)ptr - (const char*)heap) : 0;
+}
+
+#define PERSISTENT_PTR(heap, type, offset) ((type*)persistent_ptr((heap), (offset)))
+
+// Commit up to the granularity boundary past the first `bytes` bytes.
+// Boundaries are absolute addresses so whole huge pages get committed.
+static inline bool persistent_heap_commit(PersistentHeap* heap, uint64_t bytes) {
+    uint64_t target = vm_align_up((uintptr_t)heap + bytes, PERSISTENT_HEAP_COMMIT_GRANULARITY) - (uintptr_t)heap;
+    if (target > heap->size) {
+        target = heap->size;
+    }
+    if (target <= heap->committed) {
+        return true;
+    }
+    if (!vm_commit((char*)heap + heap->committed, target - heap->committed)) {
+        return false;
+    }
+    heap->committed = target;
+    return true;
+}
+
+// Use `size` bytes at `memory` as a heap, keeping the contents if it already
+// holds one of the same size
+static inline PersistentHeap* persistent_heap_attach(void* memory, size_t size) {
+    PersistentHeap* heap = (PersistentHeap*)memory;
+    if (heap->magic != PERSISTENT_HEAP_MAGIC || heap->size != size) {
+        memset(heap, 0, sizeof(*heap));
+        heap->magic = PERSISTENT_HEAP_MAGIC;
+        heap->size = size;
+        heap->used = (sizeof(PersistentHeap) + PERSISTENT_HEAP_ALIGNMENT - 1) & ~(uint64_t)(PERSISTENT_HEAP_ALIGNMENT - 1);
+        heap->peak = heap->used;
+        persistent_heap_commit(heap, heap->used);
+    }
+    return heap;
+}
+
+// Empty a heap in place, e.g. one that failed persistent_heap_validate.
+// Pages past the header's are decommitted unless `keep_committed` holds
+// them, so `committed` stays true to what is actually committed.
+static inline void persistent_heap_reset(PersistentHeap* heap) {
+    uint64_t size = heap->size;
+    uint64_t committed = heap->committed < size ? heap->committed : size;
+    uint32_t keep_committed = heap->keep_committed;
+    memset(heap, 0, sizeof(*heap));
+    heap->magic = PERSISTENT_HEAP_MAGIC;
+    heap->size = size;
+    heap->used = (sizeof(PersistentHeap) + PERSISTENT_HEAP_ALIGNMENT - 1) & ~(uint64_t)(PERSISTENT_HEAP_ALIGNMENT - 1);
+    heap->peak = heap->used;
+    heap->committed = committed;
+    heap->keep_committed = keep_committed;
+
+    uint64_t keep = vm_align_up((uintptr_t)heap + heap->used, PERSISTENT_HEAP_COMMIT_GRANULARITY) - (uintptr_t)heap;
+    if (keep < heap->committed && !heap->keep_committed) {
+        vm_decommit((char*)heap + keep, heap->committed - keep);
+        heap->committed = keep;
+    }
+}
+
+// Bump region without stats, shared by the allocators below
+static inline PersistentOffset persistent_bump(PersistentHeap* heap, size_t size) {
+    uint64_t aligned = (size + PERSISTENT_HEAP_ALIGNMENT - 1) & ~(uint64_t)(PERSISTENT_HEAP_ALIGNMENT - 1);
+    if (aligned > heap->size - heap->used) {
+        printf("Persistent heap out of memory: %zu bytes requested, %llu of %llu used\n",
+               size, (unsigned long long)heap->used, (unsigned long long)heap->size);
+        return 0;
+    }
+    if (heap->used + aligned > heap->committed && !persistent_heap_commit(heap, heap->used + aligned)) {
+        return 0;
+    }
+    PersistentOffset offset = heap->used;
+    heap->used += aligned;
+    if (heap->used > heap->peak) {
+        heap->peak = heap->used;
+    }
+    return offset;
+}
+
+// Bump allocation; the memory is only reclaimed when the heap is reset
+static inline PersistentOffset persistent_push(PersistentHeap* heap, size_t size, MemoryTag tag) {
+    PersistentOffset offset = persistent_bump(heap, size);
+    if (offset) {
+        memory_stats_add(heap->tags, tag, size);
+    }
+    return offset;
+}
+
+// The named pool if it exists, for code that uses a pool another module
+// creates
+static inline PersistentPool* persistent_pool_find(PersistentHeap* heap, const char* name) {
+    uint64_t name_hash = hash_string(name);
+    for (uint32_t i = 0; i < heap->pool_count; i++) {
+        if (heap->pools[i].name_hash == name_hash) {
+            return &heap->pools[i];
+        }
+    }
+    return NULL;
+}
+
+// Free every element at once by threading them all back onto the free
+// list, lowest address first
+static inline void persistent_pool_clear(PersistentHeap* heap, PersistentPool* pool) {
+    heap->tags[pool->tag < MEMORY_TAG_COUNT ? pool->tag : MEMORY_TAG_UNTAGGED].frees += pool->live_count;
+    pool->live_count = 0;
+    pool->free_head = 0;
+    for (uint32_t i = pool->capacity; i > 0; i--) {
+        PersistentOffset element = pool->elements + (PersistentOffset)(i - 1) * pool->element_size;
+        *PERSISTENT_PTR(heap, PersistentOffset, element) = pool->free_head;
+        pool->free_head = element;
+    }
+}
+
+// Find the named pool, creating it on first use. Elements keep their
+// contents across reloads as long as the element size doesn't change.
+// The pool's whole block counts towards `tag` as soon as it is reserved.
+static inline PersistentPool* persistent_pool(PersistentHeap* heap, const char* name, uint32_t element_size, uint32_t capacity, MemoryTag tag) {
+    uint64_t name_hash = hash_string(name);
+    element_size = (element_size + PERSISTENT_HEAP_ALIGNMENT - 1) & ~(uint32_t)(PERSISTENT_HEAP_ALIGNMENT - 1);
+    PersistentPool* pool = persistent_pool_find(heap, name);
+
+    if (pool && pool->element_size == element_size && pool->capacity >= capacity) {
+        return pool;
+    }
+    if (pool) {
+        // The bump region can't take the old elements back; they stay leaked
+        // until the heap is reset
+        printf("Persistent pool '%s' changed (%u x %u -> %u x %u bytes), contents dropped\n",
+               name, pool->capacity, pool->element_size, capacity, element_size);
+    } else if (heap->pool_count == PERSISTENT_HEAP_MAX_POOLS) {
+        printf("Persistent heap has no room for pool '%s'\n", name);
+        return NULL;
+    } else {
+        pool = &heap->pools[heap->pool_count++];
+    }
+
+    PersistentOffset elements = persistent_push(heap, (size_t)element_size * capacity, tag);
+    memset(pool, 0, sizeof(*pool));
+    pool->name_hash = name_hash;
+    if (!elements) {
+        return pool;
+    }
+    pool->element_size = element_size;
+    pool->capacity = capacity;
+    pool->tag = tag;
+    pool->elements = elements;
+    persistent_pool_clear(heap, pool);
+    return pool;
+}
+
+static inline PersistentOffset persistent_pool_alloc(PersistentHeap* heap, PersistentPool* pool) {
+    PersistentOffset element = pool->free_head;
+    if (!element) {
+        return 0;
+    }
+    pool->free_head = *PERSISTENT_PTR(heap, PersistentOffset, element);
+    pool->live_count++;
+    heap->tags[pool->tag < MEMORY_TAG_COUNT ? pool->tag : MEMORY_TAG_UNTAGGED].allocations++;
+    memset(persistent_ptr(heap, element), 0, pool->element_size);
+    return element;
+}
+
+static inline void persistent_pool_free(PersistentHeap* heap, PersistentPool* pool, PersistentOffset element) {
+    if (!element) {
+        return;
+    }
+    *PERSISTENT_PTR(heap, PersistentOffset, element) = pool->free_head;
+    pool->free_head = element;
+    pool->live_count--;
+    heap->tags[pool->tag < MEMORY_TAG_COUNT ? pool->tag : MEMORY_TAG_UNTAGGED].frees++;
+}
+
+// Size class that fits `size` bytes plus the block header, or -1 if too large
+static inline int persistent_size_class(size_t size) {
+    size_t block_size = size + sizeof(PersistentBlockHeader);
+    for (int size_class = 0; size_class < PERSISTENT_SIZE_CLASS_COUNT; size_class++) {
+        if (block_size <= ((size_t)1 << (size_class + PERSISTENT_SIZE_CLASS_MIN_SHIFT))) {
+            return size_class;
+        }
+    }
+    return -1;
+}
+
+// General allocation from power of two size classes. Freed blocks go back on
+// their class's free list, so a steady workload stops growing the heap.
+static inline PersistentOffset persistent_alloc(PersistentHeap* heap, size_t size, MemoryTag tag) {
+    int size_class = persistent_size_class(size);
+    if (size_class < 0) {
+        printf("Persistent allocation of %zu bytes exceeds the largest size class\n", size);
+        return 0;
+    }
+
+    PersistentOffset block = heap->size_class_free[size_class];
+    if (block) {
+        heap->size_class_free[size_class] = *PERSISTENT_PTR(heap, PersistentOffset, block + sizeof(PersistentBlockHeader));
+    } else {
+        block = persistent_bump(heap, (size_t)1 << (size_class + PERSISTENT_SIZE_CLASS_MIN_SHIFT));
+        if (!block) {
+            return 0;
+        }
+    }
+
+    PersistentBlockHeader* header = PERSISTENT_PTR(heap, PersistentBlockHeader, block);
+    header->magic = PERSISTENT_BLOCK_MAGIC;
+    header->size_class = (uint32_t)size_class;
+    header->tag = (uint32_t)tag;
+    memory_stats_add(heap->tags, tag, (uint64_t)1 << (size_class + PERSISTENT_SIZE_CLASS_MIN_SHIFT));
+    return block + sizeof(PersistentBlockHeader);
+}
+
+static inline void persistent_free(PersistentHeap* heap, PersistentOffset offset) {
+    if (!offset) {
+        return;
+    }
+    PersistentOffset block = offset - sizeof(PersistentBlockHeader);
+    PersistentBlockHeader* header = PERSISTENT_PTR(heap, PersistentBlockHeader, block);
+    if (header->magic != PERSISTENT_BLOCK_MAGIC || header->size_class >= PERSISTENT_SIZE_CLASS_COUNT) {
+        printf("persistent_free: %llu is not a live block\n", (unsigned long long)offset);
+        return;
+    }
+    header->magic = 0;
+    memory_stats_remove(heap->tags, (MemoryTag)header->tag, (uint64_t)1 << (header->size_class + PERSISTENT_SIZE_CLASS_MIN_SHIFT));
+    *PERSISTENT_PTR(heap, PersistentOffset, offset) = heap->size_class_free[header->size_class];
+    heap->size_class_free[header->size_class] = offset - sizeof(PersistentBlockHeader);
+}
+
+// Scope for data with a shorter life than the heap, such as a level: take a
+// mark before loading it and release back to the mark when unloading it.
+static inline PersistentHeapMark persistent_heap_mark(PersistentHeap* heap) {
+    PersistentHeapMark mark;
+    mark.used = heap->used;
+    mark.pool_count = heap->pool_count;
+    for (int tag = 0; tag < MEMORY_TAG_COUNT; tag++) {
+        mark.tag_bytes[tag] = heap->tags[tag].current_bytes;
+    }
+    return mark;
+}
+
+// Free everything allocated since `mark` in one go: the bump region, pools
+// created or resized since, and size class blocks carved out since, then
+// decommit the pages that freed unless `keep_committed` is set. Per tag byte
+// counts return to their values at the mark.
+static inline void persistent_heap_release(PersistentHeap* heap, PersistentHeapMark mark) {
+    if (mark.used > heap->used || mark.pool_count > heap->pool_count) {
+        printf("persistent_heap_release: mark is not older than the heap\n");
+        return;
+    }
+
+    heap->pool_count = mark.pool_count;
+    for (uint32_t i = 0; i < heap->pool_count; i++) {
+        PersistentPool* pool = &heap->pools[i];
+        if (pool->elements >= mark.used) {
+            uint64_t name_hash = pool->name_hash;
+            memset(pool, 0, sizeof(*pool));
+            pool->name_hash = name_hash;
+        }
+    }
+
+    for (int size_class = 0; size_class < PERSISTENT_SIZE_CLASS_COUNT; size_class++) {
+        PersistentOffset* link = &heap->size_class_free[size_class];
+        while (*link) {
+            if (*link >= mark.used) {
+                *link = *PERSISTENT_PTR(heap, PersistentOffset, *link + sizeof(PersistentBlockHeader));
+            } else {
+                link = PERSISTENT_PTR(heap, PersistentOffset, *link + sizeof(PersistentBlockHeader));
+            }
+        }
+    }
+
+    for (int tag = 0; tag < MEMORY_TAG_COUNT; tag++) {
+        if (heap->tags[tag].current_bytes > mark.tag_bytes[tag]) {
+            heap->tags[tag].current_bytes = mark.tag_bytes[tag];
+        }
+    }
+
+    heap->used = mark.used;
+    uint64_t keep = vm_align_up((uintptr_t)heap + heap->used, PERSISTENT_HEAP_COMMIT_GRANULARITY) - (uintptr_t)heap;
+    if (keep < heap->committed && !heap->keep_committed) {
+        vm_decommit((char*)heap + keep, heap->committed - keep);
+        heap->committed = keep;
+    }
+}
+
+// Walk the bookkeeping and report anything inconsistent: free list links
+// outside the bump region or in use, pools whose free and live counts don't
+// add up. Every link is followed, so this costs a pass over the free lists;
+// modules run it when they attach, which is when a build that disagrees
+// about the layout would show.
+static inline bool persistent_heap_validate(PersistentHeap* heap) {
+    uint64_t first = (sizeof(PersistentHeap) + PERSISTENT_HEAP_ALIGNMENT - 1) & ~(uint64_t)(PERSISTENT_HEAP_ALIGNMENT - 1);
+    if (heap->used < first || heap->used > heap->committed || heap->committed > heap->size || heap->peak < heap->used) {
+        printf("Persistent heap: bad extents (used %llu, peak %llu, committed %llu, size %llu)\n",
+               (unsigned long long)heap->used, (unsigned long long)heap->peak,
+               (unsigned long long)heap->committed, (unsigned long long)heap->size);
+        return false;
+    }
+    bool ok = true;
+
+    for (int size_class = 0; size_class < PERSISTENT_SIZE_CLASS_COUNT; size_class++) {
+        uint64_t block_size = (uint64_t)1 << (size_class + PERSISTENT_SIZE_CLASS_MIN_SHIFT);
+        // Longer than the heap could hold means the list loops
+        uint64_t limit = heap->used / block_size;
+        uint64_t length = 0;
+        for (PersistentOffset block = heap->size_class_free[size_class]; block; length++) {
+            const PersistentBlockHeader* header = PERSISTENT_PTR(heap, PersistentBlockHeader, block);
+            if (block < first || block + block_size > heap->used || block % PERSISTENT_HEAP_ALIGNMENT || length > limit) {
+                printf("Persistent heap: size class %d free list is broken at %llu\n", size_class, (unsigned long long)block);
+                ok = false;
+                break;
+            }
+            if (header->magic == PERSISTENT_BLOCK_MAGIC) {
+                printf("Persistent heap: live block %llu is on the size class %d free list\n", (unsigned long long)block, size_class);
+                ok = false;
+                break;
+            }
+            block = *PERSISTENT_PTR(heap, PersistentOffset, block + sizeof(PersistentBlockHeader));
+        }
+    }
+
+    for (uint32_t i = 0; i < heap->pool_count; i++) {
+        const PersistentPool* pool = &heap->pools[i];
+        if (!pool->elements) {
+            continue;
+        }
+        uint64_t end = pool->elements + (uint64_t)pool->element_size * pool->capacity;
+        if (pool->elements < first || end > heap->used || pool->live_count > pool->capacity) {
+            printf("Persistent heap: pool %u has bad extents\n", i);
+            ok = false;
+            continue;
+        }
+        uint32_t free_count = 0;
+        bool list_ok = true;
+        for (PersistentOffset element = pool->free_head; element; free_count++) {
+            if (element < pool->elements || element >= end || (element - pool->elements) % pool->element_size ||
+                free_count >= pool->capacity) {
+                printf("Persistent heap: pool %u free list is broken at %llu\n", i, (unsigned long long)element);
+                list_ok = false;
+                break;
+            }
+            element = *PERSISTENT_PTR(heap, PersistentOffset, element);
+        }
+        if (!list_ok) {
+            ok = false;
+        } else if (free_count + pool->live_count != pool->capacity) {
+            printf("Persistent heap: pool %u has %u free and %u live of %u\n", i, free_count, pool->live_count, pool->capacity);
+            ok = false;
+        }
+    }
+    return ok;
+}
+#endif
@@ -0,0 +1,95 @@
+#ifndef RELOAD_TIMING_H
+#define RELOAD_TIMING_H
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Hot reload latency instrumentation shared by build.c and main.c.
+// build.c stamps the build stages into a small memory-mapped file and bumps
+// `sequence` once the library is written; main.c stamps the load stages and
+// prints the end to end breakdown after the first frame on the new code.
+// Stamps are CLOCK_REALTIME nanoseconds so they compare with file mtimes
+// and across processes.
+
+#define RELOAD_TIMING_FILE "reload_timing.bin"
+#define RELOAD_TIMING_MAGIC 0x524C544Du
+
+typedef enum {
+    // Written by build.c
+    RELOAD_STAGE_EDIT,
+    RELOAD_STAGE_BUILD_DETECTED,
+    RELOAD_STAGE_COMPILE_START,
+    RELOAD_STAGE_COMPILE_DONE,
+    RELOAD_STAGE_LINK_DONE,
+    // Written by main.c
+    RELOAD_STAGE_LIBRARY_NOTIFIED,
+    RELOAD_STAGE_RELOAD_START,
+    RELOAD_STAGE_LIBRARY_STAGED,
+    RELOAD_STAGE_LIBRARY_LOADED,
+    RELOAD_STAGE_ENGINE_INITIALIZED,
+    RELOAD_STAGE_FIRST_FRAME,
+    RELOAD_STAGE_COUNT
+} ReloadStage;
+
+#define RELOAD_STAGE_FIRST_PLATFORM RELOAD_STAGE_LIBRARY_NOTIFIED
+
+typedef struct {
+    uint32_t magic;
+    volatile uint32_t sequence;
+    int64_t stamps[RELOAD_STAGE_COUNT];
+} ReloadTimingShared;
+
+static inline const char* reload_stage_name(int stage) {
+    switch (stage) {
+        case RELOAD_STAGE_EDIT:               return "file edited";
+        case RELOAD_STAGE_BUILD_DETECTED:     return "build noticed";
+        case RELOAD_STAGE_COMPILE_START:      return "compile started";
+        case RELOAD_STAGE_COMPILE_DONE:       return "compile finished";
+        case RELOAD_STAGE_LINK_DONE:          return "link finished";
+        case RELOAD_STAGE_LIBRARY_NOTIFIED:   return "engine notified";
+        case RELOAD_STAGE_RELOAD_START:       return "reload started";
+        case RELOAD_STAGE_LIBRARY_STAGED:     return "library copied";
+        case RELOAD_STAGE_LIBRARY_LOADED:     return "dlopen finished";
+        case RELOAD_STAGE_ENGINE_INITIALIZED: return "engine_init finished";
+        case RELOAD_STAGE_FIRST_FRAME:        return "first frame done";
+        default:                              return "unknown";
+    }
+}
+
+static inline int64_t reload_timing_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Map the shared timing block, creating it if needed. Returns NULL on failure.
+static inline ReloadTimingShared* reload_timing_map(void) {
+    int fd = open(RELOAD_TIMING_FILE, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (ftruncate(fd, sizeof(ReloadTimingShared)) != 0) {
+        close(fd);
+        return NULL;
+    }
+    void* memory = mmap(NULL, sizeof(ReloadTimingShared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        return NULL;
+    }
+
+    ReloadTimingShared* shared = (ReloadTimingShared*)memory;
+    if (shared->magic != RELOAD_TIMING_MAGIC) {
+        shared->sequence = 0;
+        for (int i = 0; i < RELOAD_STAGE_COUNT; i++) {
+            shared->stamps[i] = 0;
+        }
+        shared->magic = RELOAD_TIMING_MAGIC;
+    }
+    return shared;
+}
+
+#endif
@@ -0,0 +1,216 @@
+#ifndef RENDER_COMMANDS_H
+#define RENDER_COMMANDS_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "MemoryArena.h"
+
+// Render modules don't call GL to draw. They record commands into frame
+// memory, each with a 64-bit sort key, and main.c sorts the frame's commands
+// and executes them, changing GL state only where consecutive commands
+// differ. Commands hold plain GL handles and pointers into frame memory or
+// module data, so they are only valid for the frame that recorded them.
+//
+// Sort key, most significant first:
+//   layer   8 bits  pass order: clears, opaque, translucent, fences...
+//   program 16 bits
+//   texture 16 bits
+//   depth   24 bits 0 is nearest; front to back within a program/texture
+// The sort is stable, so commands with equal keys run in recording order.
+
+#define RENDER_LAYER_CLEAR       0
+#define RENDER_LAYER_OPAQUE      64
+#define RENDER_LAYER_TRANSLUCENT 128
+// After every draw that could read data the fence protects
+#define RENDER_LAYER_FENCE       255
+
+typedef enum {
+    RENDER_COMMAND_CLEAR,
+    RENDER_COMMAND_DRAW,
+    RENDER_COMMAND_FENCE
+} RenderCommandType;
+
+// GL state a draw needs; executing a command sets exactly these
+typedef enum {
+    RENDER_STATE_DEPTH_TEST  = 1u << 0,
+    RENDER_STATE_ALPHA_BLEND = 1u << 1
+} RenderStateFlags;
+
+// Per-instance vertex attributes read from `instance_buffer`
+#define RENDER_MAX_INSTANCE_ATTRIBUTES 8
+
+typedef struct {
+    int32_t location;
+    int32_t size;
+    uint32_t type;
+    uint32_t normalized;
+    uint32_t offset;
+} RenderInstanceAttribute;
+
+typedef struct {
+    uint32_t stride;
+    uint32_t attribute_count;
+    RenderInstanceAttribute attributes[RENDER_MAX_INSTANCE_ATTRIBUTES];
+} RenderInstanceLayout;
+
+typedef struct {
+    uint64_t sort_key;
+    uint16_t type;
+    uint16_t state;
+    union {
+        struct {
+            float color[4];
+        } clear;
+        struct {
+            uint32_t program;
+            uint32_t texture;
+            uint32_t vertex_array;
+            uint32_t primitive;
+            uint32_t first;
+            uint32_t count;
+            // 0 for a plain glDrawArrays
+            uint32_t instance_count;
+            uint32_t instance_buffer;
+            // Byte offset of the first instance in `instance_buffer`
+            uint64_t instance_offset;
+            const RenderInstanceLayout* instance_layout;
+            // Column-major 4x4 matrix for the uniform at `transform_location`
+            const float* transform;
+            int32_t transform_location;
+        } draw;
+        struct {
+            // Receives the GLsync created once everything before it is queued
+            void** sync;
+        } fence;
+    };
+} RenderCommand;
+
+typedef struct {
+    RenderCommand* commands;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t dropped;
+    // Per-frame payloads such as transforms are copied here
+    MemoryArena* arena;
+} RenderCommandBuffer;
+
+// What executing a frame's commands cost, for profiling without a GPU
+typedef struct {
+    uint32_t commands;
+    uint32_t draws;
+    uint32_t program_changes;
+    uint32_t texture_changes;
+    uint32_t vertex_array_changes;
+    uint32_t state_changes;
+} RenderCommandStats;
+
+static inline uint64_t render_sort_key(uint32_t layer, uint32_t program, uint32_t texture, float depth) {
+    if (depth < 0.0f) {
+        depth = 0.0f;
+    } else if (depth > 1.0f) {
+        depth = 1.0f;
+    }
+    uint64_t depth_bits = (uint64_t)(depth * (float)0xFFFFFF);
+    return (uint64_t)(layer & 0xFF) << 56 | (uint64_t)(program & 0xFFFF) << 40 |
+           (uint64_t)(texture & 0xFFFF) << 24 | depth_bits;
+}
+
+// Start a frame's buffer with room for `capacity` commands from `arena`
+static inline void render_commands_begin(RenderCommandBuffer* buffer, MemoryArena* arena, uint32_t capacity) {
+    buffer->arena = arena;
+    buffer->count = 0;
+    buffer->dropped = 0;
+    buffer->commands = arena_push_array(arena, RenderCommand, capacity, MEMORY_TAG_RENDER);
+    buffer->capacity = buffer->commands ? capacity : 0;
+}
+
+// Append a zeroed command, or return NULL (and count it) when full
+static inline RenderCommand* render_command_push(RenderCommandBuffer* buffer, RenderCommandType type, uint64_t sort_key) {
+    if (buffer->count == buffer->capacity) {
+        buffer->dropped++;
+        return NULL;
+    }
+    RenderCommand* command = &buffer->commands[buffer->count++];
+    memset(command, 0, sizeof(*command));
+    command->sort_key = sort_key;
+    command->type = (uint16_t)type;
+    return command;
+}
+
+static inline void render_clear(RenderCommandBuffer* buffer, float r, float g, float b, float a) {
+    RenderCommand* command = render_command_push(buffer, RENDER_COMMAND_CLEAR, render_sort_key(RENDER_LAYER_CLEAR, 0, 0, 0.0f));
+    if (command) {
+        command->clear.color[0] = r;
+        command->clear.color[1] = g;
+        command->clear.color[2] = b;
+        command->clear.color[3] = a;
+    }
+}
+
+// Copy a 4x4 matrix into frame memory for a draw to reference
+static inline const float* render_push_transform(RenderCommandBuffer* buffer, const float* matrix) {
+    float* copy = arena_push_array(buffer->arena, float, 16, MEMORY_TAG_RENDER);
+    if (copy) {
+        memcpy(copy, matrix, 16 * sizeof(float));
+    }
+    return copy;
+}
+
+static inline void render_fence(RenderCommandBuffer* buffer, void** sync) {
+    RenderCommand* command = render_command_push(buffer, RENDER_COMMAND_FENCE, render_sort_key(RENDER_LAYER_FENCE, 0, 0, 1.0f));
+    if (command) {
+        command->fence.sync = sync;
+    }
+}
+
+// Order of the commands by key: `order` receives `count` indices. LSD radix
+// sort, one byte per pass; passes where every key has the same byte are
+// skipped, which for typical keys is most of them. Stable.
+static inline void render_commands_sort(const RenderCommand* commands, uint32_t count, uint32_t* order, MemoryArena* scratch) {
+    for (uint32_t i = 0; i < count; i++) {
+        order[i] = i;
+    }
+    if (count < 2) {
+        return;
+    }
+
+    ArenaMarker marker = arena_begin_temp(scratch);
+    uint32_t* other = arena_push_array(scratch, uint32_t, count, MEMORY_TAG_SCRATCH);
+    if (!other) {
+        arena_end_temp(marker);
+        return;
+    }
+
+    uint32_t* source = order;
+    uint32_t* target = other;
+    for (int shift = 0; shift < 64; shift += 8) {
+        uint32_t histogram[256] = {0};
+        for (uint32_t i = 0; i < count; i++) {
+            histogram[(commands[i].sort_key >> shift) & 0xFF]++;
+        }
+        if (histogram[(commands[0].sort_key >> shift) & 0xFF] == count) {
+            continue;
+        }
+
+        uint32_t offset = 0;
+        for (int digit = 0; digit < 256; digit++) {
+            uint32_t digit_count = histogram[digit];
+            histogram[digit] = offset;
+            offset += digit_count;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t index = source[i];
+            target[histogram[(commands[index].sort_key >> shift) & 0xFF]++] = index;
+        }
+        uint32_t* swap = source;
+        source = target;
+        target = swap;
+    }
+
+    if (source != order) {
+        memcpy(order, source, count * sizeof(uint32_t));
+    }
+    arena_end_temp(marker);
+}
+#endif
@@ -0,0 +1,67 @@
+#ifndef TEXTURE_ATLAS_H
+#define TEXTURE_ATLAS_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "hash.h"
+
+// Sprite images are packed offline by atlas_packer into a few large pages so
+// that sprites from different images can share a texture, and with it a
+// batch. For an output prefix P the packer writes:
+//   P.atlas      AtlasHeader, page_count AtlasPages, region_count AtlasRegions
+//   P_<n>.tga    page n, 32-bit RGBA (see Image.h)
+// Regions are sorted by asset ID for atlas_find. An image's asset ID is the
+// hash of its file name without directory or extension, so "ship.bmp" is
+// atlas_asset_id("ship").
+
+#define ATLAS_MAGIC 0x534C5441u // "ATLS"
+#define ATLAS_VERSION 1
+#define ATLAS_MAX_PAGES 16
+#define ATLAS_PATH_MAX 256
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t page_count;
+    uint32_t region_count;
+} AtlasHeader;
+
+typedef struct {
+    uint32_t width;
+    uint32_t height;
+} AtlasPage;
+
+typedef struct {
+    uint64_t asset_id;
+    uint32_t page;
+    // Pixel rectangle of the image in its page, padding excluded
+    uint16_t x, y;
+    uint16_t width, height;
+    // u0, v0, u1, v1 with v0 at the top row, matching SpriteInstance
+    float uv_rect[4];
+} AtlasRegion;
+
+static inline uint64_t atlas_asset_id(const char* name) {
+    return hash_string(name);
+}
+
+static inline void atlas_page_path(char* out, size_t size, const char* prefix, uint32_t page) {
+    snprintf(out, size, "%s_%u.tga", prefix, page);
+}
+
+// Binary search of a table sorted by asset ID; NULL if the asset isn't there
+static inline const AtlasRegion* atlas_find(const AtlasRegion* regions, uint32_t count, uint64_t asset_id) {
+    uint32_t low = 0;
+    uint32_t high = count;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (regions[middle].asset_id < asset_id) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low < count && regions[low].asset_id == asset_id ? &regions[low] : NULL;
+}
+#endif
@@ -0,0 +1,74 @@
+#ifndef VIRTUAL_MEMORY_H
+#define VIRTUAL_MEMORY_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Reserve-then-commit address space for the growable memory blocks.
+// A reservation is mapped with no access and no swap accounting, so a
+// multi-gigabyte range costs nothing until it is used. Allocators commit
+// pages (make them read/write) as they grow into them; everything past the
+// committed end stays inaccessible, so an overrun faults at once instead of
+// scribbling over whatever lies next to the block. Every reservation ends
+// with VM_GUARD_SIZE bytes that are never committed.
+
+#define VM_GUARD_SIZE (64 * 1024)
+
+static inline size_t vm_page_size(void) {
+    static size_t page_size = 0;
+    if (!page_size) {
+        page_size = (size_t)sysconf(_SC_PAGESIZE);
+    }
+    return page_size;
+}
+
+// `alignment` must be a power of two
+static inline uintptr_t vm_align_up(uintptr_t value, uintptr_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+// Reserve `size` usable bytes plus the trailing guard anywhere in the
+// address space. Returns NULL on failure.
+static inline void* vm_reserve(size_t size) {
+    void* memory = mmap(NULL, size + VM_GUARD_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (memory == MAP_FAILED) {
+        printf("Failed to reserve %zu MB of address space: %s\n", size >> 20, strerror(errno));
+        return NULL;
+    }
+    return memory;
+}
+
+static inline void vm_release(void* memory, size_t size) {
+    munmap(memory, size + VM_GUARD_SIZE);
+}
+
+// Make [start, start + size) readable and writable, widened to whole pages.
+// Pages are only backed once touched.
+static inline bool vm_commit(void* start, size_t size) {
+    uintptr_t first = (uintptr_t)start & ~(uintptr_t)(vm_page_size() - 1);
+    uintptr_t end = vm_align_up((uintptr_t)start + size, vm_page_size());
+    if (mprotect((void*)first, end - first, PROT_READ | PROT_WRITE) != 0) {
+        printf("Failed to commit %zu bytes at %p: %s\n", size, start, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// Hand the pages inside [start, start + size) back to the kernel and make
+// them inaccessible again. Anonymous pages read as zero once recommitted;
+// file-backed pages keep their contents in the file.
+static inline void vm_decommit(void* start, size_t size) {
+    uintptr_t first = vm_align_up((uintptr_t)start, vm_page_size());
+    uintptr_t end = ((uintptr_t)start + size) & ~(uintptr_t)(vm_page_size() - 1);
+    if (end <= first) {
+        return;
+    }
+    madvise((void*)first, end - first, MADV_DONTNEED);
+    mprotect((void*)first, end - first, PROT_NONE);
+}
+#endif
@@ -0,0 +1,458 @@
+// Offline sprite atlas packer. Packs BMP and TGA images into as few pages
+// as possible with a skyline bottom-left packer and writes the pages and
+// the region table described in TextureAtlas.h.
+//
+//   atlas_packer [--page-size N] [--padding N] OUTPUT_PREFIX INPUT...
+//
+// Inputs are image files or directories of them (not searched recursively).
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "MemoryArena.h"
+#include "VirtualMemory.h"
+#include "Image.h"
+#include "TextureAtlas.h"
+
+#define PACKER_DEFAULT_PAGE_SIZE 2048
+#define PACKER_MAX_PAGE_SIZE 8192
+// Border around every image, filled by repeating its edge pixels, so linear
+// filtering and mipmaps never pull in a neighbour
+#define PACKER_DEFAULT_PADDING 2
+#define PACKER_MAX_IMAGES 4096
+#define PACKER_MEMORY_SIZE (4ull * 1024 * 1024 * 1024)
+#define PACKER_COMMIT_GRANULARITY (1024 * 1024)
+
+typedef struct {
+    char path[ATLAS_PATH_MAX];
+    char name[ATLAS_PATH_MAX];
+    Image image;
+    uint32_t page;
+    int x, y;
+} PackerImage;
+
+// Top edge of everything packed on a page so far, as horizontal segments
+// from left to right. A new rectangle always sits on the skyline, so the
+// space under it is never used again; sorting the images tallest first
+// keeps that waste small.
+typedef struct {
+    int x, y;
+    int width;
+} SkylineNode;
+
+typedef struct {
+    // Nodes are at least a pixel wide; one more while a placement is merged
+    SkylineNode nodes[PACKER_MAX_PAGE_SIZE + 1];
+    int node_count;
+    // Extent actually used, which the page is trimmed to
+    int used_width;
+    int used_height;
+} SkylinePage;
+
+typedef struct {
+    PackerImage* images;
+    uint32_t image_count;
+    SkylinePage* pages[ATLAS_MAX_PAGES];
+    uint32_t page_count;
+    int page_size;
+    int padding;
+    MemoryArena arena;
+} Packer;
+
+static bool has_image_extension(const char* path) {
+    const char* dot = strrchr(path, '.');
+    return dot && (strcasecmp(dot, ".bmp") == 0 || strcasecmp(dot, ".tga") == 0);
+}
+
+// Asset name: the file name without directory or extension
+static void asset_name(const char* path, char* out, size_t size) {
+    const char* slash = strrchr(path, '/');
+    const char* start = slash ? slash + 1 : path;
+    const char* dot = strrchr(start, '.');
+    size_t length = dot ? (size_t)(dot - start) : strlen(start);
+    if (length >= size) {
+        length = size - 1;
+    }
+    memcpy(out, start, length);
+    out[length] = '\0';
+}
+
+static bool add_image(Packer* packer, const char* path) {
+    if (packer->image_count == PACKER_MAX_IMAGES) {
+        printf("Too many images, at most %d fit in one atlas\n", PACKER_MAX_IMAGES);
+        return false;
+    }
+    PackerImage* entry = &packer->images[packer->image_count];
+    if (snprintf(entry->path, sizeof(entry->path), "%s", path) >= (int)sizeof(entry->path)) {
+        printf("Path too long: %s\n", path);
+        return false;
+    }
+    asset_name(path, entry->name, sizeof(entry->name));
+    if (!image_load(path, &entry->image, &packer->arena)) {
+        return false;
+    }
+    packer->image_count++;
+    return true;
+}
+
+static bool add_input(Packer* packer, const char* path) {
+    struct stat info;
+    if (stat(path, &info) != 0) {
+        printf("No such file or directory: %s\n", path);
+        return false;
+    }
+    if (!S_ISDIR(info.st_mode)) {
+        return add_image(packer, path);
+    }
+
+    DIR* dir = opendir(path);
+    if (!dir) {
+        printf("Failed to open directory %s\n", path);
+        return false;
+    }
+    bool ok = true;
+    struct dirent* entry;
+    while (ok && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.' || !has_image_extension(entry->d_name)) {
+            continue;
+        }
+        char file[ATLAS_PATH_MAX];
+        if (snprintf(file, sizeof(file), "%s/%s", path, entry->d_name) >= (int)sizeof(file)) {
+            printf("Path too long: %s/%s\n", path, entry->d_name);
+            ok = false;
+        } else {
+            ok = add_image(packer, file);
+        }
+    }
+    closedir(dir);
+    return ok;
+}
+
+// Tallest first, then widest; names break ties so the output doesn't
+// depend on directory order
+static int compare_images(const void* a, const void* b) {
+    const PackerImage* ia = (const PackerImage*)a;
+    const PackerImage* ib = (const PackerImage*)b;
+    if (ia->image.height != ib->image.height) {
+        return ib->image.height - ia->image.height;
+    }
+    if (ia->image.width != ib->image.width) {
+        return ib->image.width - ia->image.width;
+    }
+    return strcmp(ia->name, ib->name);
+}
+
+static SkylinePage* skyline_page_create(Packer* packer) {
+    if (packer->page_count == ATLAS_MAX_PAGES) {
+        return NULL;
+    }
+    SkylinePage* page = arena_push_struct(&packer->arena, SkylinePage, MEMORY_TAG_UNTAGGED);
+    if (!page) {
+        return NULL;
+    }
+    page->nodes[0].x = 0;
+    page->nodes[0].y = 0;
+    page->nodes[0].width = packer->page_size;
+    page->node_count = 1;
+    page->used_width = 0;
+    page->used_height = 0;
+    packer->pages[packer->page_count++] = page;
+    return page;
+}
+
+// Lowest y a width x height rectangle can have with its left edge on node
+// `index`, or -1 if it doesn't fit there
+static int skyline_fit(const SkylinePage* page, int page_size, int index, int width, int height) {
+    int x = page->nodes[index].x;
+    if (x + width > page_size) {
+        return -1;
+    }
+    int y = 0;
+    int remaining = width;
+    for (int i = index; remaining > 0; i++) {
+        if (page->nodes[i].y > y) {
+            y = page->nodes[i].y;
+        }
+        remaining -= page->nodes[i].width;
+    }
+    return y + height <= page_size ? y : -1;
+}
+
+// Bottom-left rule: the position with the lowest top edge, then the
+// narrowest node so wide gaps stay open for wide images
+static bool skyline_find(const SkylinePage* page, int page_size, int width, int height, int* best_index, int* best_y) {
+    int best_top = INT32_MAX;
+    int best_width = INT32_MAX;
+    *best_index = -1;
+    for (int i = 0; i < page->node_count; i++) {
+        int y = skyline_fit(page, page_size, i, width, height);
+        if (y < 0) {
+            continue;
+        }
+        if (y + height < best_top || (y + height == best_top && page->nodes[i].width < best_width)) {
+            best_top = y + height;
+            best_width = page->nodes[i].width;
+            *best_index = i;
+            *best_y = y;
+        }
+    }
+    return *best_index >= 0;
+}
+
+static void skyline_place(SkylinePage* page, int index, int y, int width, int height) {
+    int x = page->nodes[index].x;
+    memmove(&page->nodes[index + 1], &page->nodes[index], (size_t)(page->node_count - index) * sizeof(SkylineNode));
+    page->nodes[index].x = x;
+    page->nodes[index].y = y + height;
+    page->nodes[index].width = width;
+    page->node_count++;
+
+    // Cut away whatever the new node now covers
+    for (int i = index + 1; i < page->node_count; i++) {
+        const SkylineNode* previous = &page->nodes[i - 1];
+        int overlap = previous->x + previous->width - page->nodes[i].x;
+        if (overlap <= 0) {
+            break;
+        }
+        page->nodes[i].x += overlap;
+        page->nodes[i].width -= overlap;
+        if (page->nodes[i].width > 0) {
+            break;
+        }
+        memmove(&page->nodes[i], &page->nodes[i + 1], (size_t)(page->node_count - i - 1) * sizeof(SkylineNode));
+        page->node_count--;
+        i--;
+    }
+
+    // Merge neighbours at the same height
+    for (int i = 0; i + 1 < page->node_count; i++) {
+        if (page->nodes[i].y == page->nodes[i + 1].y) {
+            page->nodes[i].width += page->nodes[i + 1].width;
+            memmove(&page->nodes[i + 1], &page->nodes[i + 2], (size_t)(page->node_count - i - 2) * sizeof(SkylineNode));
+            page->node_count--;
+            i--;
+        }
+    }
+
+    if (x + width > page->used_width) {
+        page->used_width = x + width;
+    }
+    if (y + height > page->used_height) {
+        page->used_height = y + height;
+    }
+}
+
+// Place every image on the first page it fits on, opening pages as needed
+static bool pack_images(Packer* packer) {
+    qsort(packer->images, packer->image_count, sizeof(PackerImage), compare_images);
+    for (uint32_t i = 0; i < packer->image_count; i++) {
+        PackerImage* entry = &packer->images[i];
+        int width = entry->image.width + 2 * packer->padding;
+        int height = entry->image.height + 2 * packer->padding;
+        if (width > packer->page_size || height > packer->page_size) {
+            printf("%s (%dx%d) does not fit on a %dx%d page\n", entry->path,
+                   entry->image.width, entry->image.height, packer->page_size, packer->page_size);
+            return false;
+        }
+
+        int index = -1;
+        int y = 0;
+        uint32_t page = 0;
+        while (page < packer->page_count && !skyline_find(packer->pages[page], packer->page_size, width, height, &index, &y)) {
+            page++;
+        }
+        if (page == packer->page_count) {
+            if (!skyline_page_create(packer)) {
+                printf("Images need more than %d pages of %dx%d\n", ATLAS_MAX_PAGES, packer->page_size, packer->page_size);
+                return false;
+            }
+            skyline_find(packer->pages[page], packer->page_size, width, height, &index, &y);
+        }
+
+        SkylinePage* skyline = packer->pages[page];
+        entry->page = page;
+        entry->x = skyline->nodes[index].x + packer->padding;
+        entry->y = y + packer->padding;
+        skyline_place(skyline, index, y, width, height);
+    }
+    return true;
+}
+
+static int next_power_of_two(int value) {
+    int result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+// Copy an image into its page, repeating edge pixels into the padding
+static void blit_padded(Image* page, const PackerImage* entry, int padding) {
+    const Image* image = &entry->image;
+    for (int y = -padding; y < image->height + padding; y++) {
+        int source_y = y < 0 ? 0 : (y >= image->height ? image->height - 1 : y);
+        uint32_t* dst = page->pixels + (size_t)(entry->y + y) * page->width + entry->x;
+        const uint32_t* src = image->pixels + (size_t)source_y * image->width;
+        for (int x = -padding; x < image->width + padding; x++) {
+            int source_x = x < 0 ? 0 : (x >= image->width ? image->width - 1 : x);
+            dst[x] = src[source_x];
+        }
+    }
+}
+
+static int compare_regions(const void* a, const void* b) {
+    uint64_t ia = ((const AtlasRegion*)a)->asset_id;
+    uint64_t ib = ((const AtlasRegion*)b)->asset_id;
+    return (ia > ib) - (ia < ib);
+}
+
+static bool write_atlas(Packer* packer, const char* prefix) {
+    AtlasPage pages[ATLAS_MAX_PAGES];
+    for (uint32_t p = 0; p < packer->page_count; p++) {
+        // Trimmed to the used area, kept a power of two for older GPUs
+        pages[p].width = (uint32_t)next_power_of_two(packer->pages[p]->used_width);
+        pages[p].height = (uint32_t)next_power_of_two(packer->pages[p]->used_height);
+
+        ArenaMarker marker = arena_begin_temp(&packer->arena);
+        Image page = { (int)pages[p].width, (int)pages[p].height, NULL };
+        page.pixels = arena_push_array_zero(&packer->arena, uint32_t, (size_t)page.width * page.height, MEMORY_TAG_SCRATCH);
+        if (!page.pixels) {
+            arena_end_temp(marker);
+            return false;
+        }
+        for (uint32_t i = 0; i < packer->image_count; i++) {
+            if (packer->images[i].page == p) {
+                blit_padded(&page, &packer->images[i], packer->padding);
+            }
+        }
+        char path[ATLAS_PATH_MAX];
+        atlas_page_path(path, sizeof(path), prefix, p);
+        bool written = image_write_tga(path, &page);
+        arena_end_temp(marker);
+        if (!written) {
+            return false;
+        }
+        printf("Wrote %s (%ux%u)\n", path, pages[p].width, pages[p].height);
+    }
+
+    AtlasRegion* regions = arena_push_array_zero(&packer->arena, AtlasRegion, packer->image_count, MEMORY_TAG_UNTAGGED);
+    if (!regions) {
+        return false;
+    }
+    for (uint32_t i = 0; i < packer->image_count; i++) {
+        const PackerImage* entry = &packer->images[i];
+        const AtlasPage* page = &pages[entry->page];
+        AtlasRegion* region = &regions[i];
+        region->asset_id = atlas_asset_id(entry->name);
+        region->page = entry->page;
+        region->x = (uint16_t)entry->x;
+        region->y = (uint16_t)entry->y;
+        region->width = (uint16_t)entry->image.width;
+        region->height = (uint16_t)entry->image.height;
+        region->uv_rect[0] = (float)entry->x / (float)page->width;
+        region->uv_rect[1] = (float)(entry->y + entry->image.height) / (float)page->height;
+        region->uv_rect[2] = (float)(entry->x + entry->image.width) / (float)page->width;
+        region->uv_rect[3] = (float)entry->y / (float)page->height;
+    }
+    qsort(regions, packer->image_count, sizeof(AtlasRegion), compare_regions);
+    for (uint32_t i = 1; i < packer->image_count; i++) {
+        if (regions[i].asset_id == regions[i - 1].asset_id) {
+            printf("Two images share an asset ID; asset names must be unique\n");
+            return false;
+        }
+    }
+
+    // The table goes last and is renamed into place, so a running renderer
+    // that watches it never reads one half written or ahead of its pages
+    char path[ATLAS_PATH_MAX];
+    char temp_path[ATLAS_PATH_MAX + 4];
+    snprintf(path, sizeof(path), "%s.atlas", prefix);
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    FILE* file = fopen(temp_path, "wb");
+    if (!file) {
+        printf("Failed to create %s\n", temp_path);
+        return false;
+    }
+    AtlasHeader header = { ATLAS_MAGIC, ATLAS_VERSION, packer->page_count, packer->image_count };
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(pages, sizeof(AtlasPage), packer->page_count, file) == packer->page_count &&
+              fwrite(regions, sizeof(AtlasRegion), packer->image_count, file) == packer->image_count;
+    if (fclose(file) != 0 || !ok) {
+        printf("Failed to write %s\n", path);
+        remove(temp_path);
+        return false;
+    }
+    // Pages an earlier, larger atlas left behind
+    for (uint32_t p = packer->page_count; p < ATLAS_MAX_PAGES; p++) {
+        char page_path[ATLAS_PATH_MAX];
+        atlas_page_path(page_path, sizeof(page_path), prefix, p);
+        if (remove(page_path) == 0) {
+            printf("Removed %s\n", page_path);
+        }
+    }
+    if (rename(temp_path, path) != 0) {
+        printf("Failed to write %s\n", path);
+        remove(temp_path);
+        return false;
+    }
+    printf("Wrote %s (%u images on %u pages)\n", path, packer->image_count, packer->page_count);
+    return true;
+}
+
+static void print_usage(const char* program) {
+    printf("usage: %s [--page-size N] [--padding N] OUTPUT_PREFIX INPUT...\n", program);
+    printf("  --page-size N  largest page width and height (default %d)\n", PACKER_DEFAULT_PAGE_SIZE);
+    printf("  --padding N    edge pixels repeated around each image (default %d)\n", PACKER_DEFAULT_PADDING);
+    printf("  INPUT          .bmp or .tga image, or a directory of them\n");
+}
+
+int main(int argc, char** argv) {
+    static Packer packer;
+    packer.page_size = PACKER_DEFAULT_PAGE_SIZE;
+    packer.padding = PACKER_DEFAULT_PADDING;
+
+    int first_input = 1;
+    while (first_input < argc && strncmp(argv[first_input], "--", 2) == 0) {
+        if (strcmp(argv[first_input], "--page-size") == 0 && first_input + 1 < argc) {
+            packer.page_size = atoi(argv[first_input + 1]);
+        } else if (strcmp(argv[first_input], "--padding") == 0 && first_input + 1 < argc) {
+            packer.padding = atoi(argv[first_input + 1]);
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+        first_input += 2;
+    }
+    if (argc - first_input < 2 || packer.page_size <= 0 || packer.page_size > PACKER_MAX_PAGE_SIZE || packer.padding < 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    const char* prefix = argv[first_input++];
+
+    void* memory = vm_reserve(PACKER_MEMORY_SIZE);
+    if (!memory) {
+        return 1;
+    }
+    arena_init_reserved(&packer.arena, memory, PACKER_MEMORY_SIZE, PACKER_COMMIT_GRANULARITY);
+    packer.images = arena_push_array_zero(&packer.arena, PackerImage, PACKER_MAX_IMAGES, MEMORY_TAG_UNTAGGED);
+    if (!packer.images) {
+        return 1;
+    }
+
+    for (int i = first_input; i < argc; i++) {
+        if (!add_input(&packer, argv[i])) {
+            return 1;
+        }
+    }
+    if (packer.image_count == 0) {
+        printf("No images to pack\n");
+        return 1;
+    }
+    if (!pack_images(&packer) || !write_atlas(&packer, prefix)) {
+        return 1;
+    }
+    return 0;
+}
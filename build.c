@@ -1,7 +1,7 @@
 #include <stdio.h>
 #include <dirent.h>
 #include <stdlib.h>
-//#include <errno.h>
+#include <errno.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -12,12 +12,20 @@
 #include <unistd.h>
 #include <stdbool.h>
 #include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#if defined(__linux__)
+#include <sys/inotify.h>
+#endif
 
 #include "platform.h"
-// keep two arrays, one of time stamps one of hash values
-// if time stamps differ then compare the hashed value
-// if the hash is different a file was deleted
-// if it matches then it was modified
+#include "ReloadTiming.h"
+#include "hash.h"
+// keep a time stamp and a content hash per watched file
+// if the time stamp differs then compare the hashed value
+// if the hash is different the file was modified
+// if it matches it was only touched or re-saved, so nothing is rebuilt
 
 typedef struct{
 	const char** src_files;
@@ -25,24 +33,130 @@ typedef struct{
 	const char** lib_files;
 	const char** libraries;
 	const char* output_name;
-	const char* extra_flags;
+	const char* compile_flags;
+	const char* link_flags;
+	const char* pch_header; // optional umbrella header precompiled once per profile
 	bool is_shared_lib;
 } BuildConfig;
 
 typedef struct {
 	const char** lib_files;
 	const char** libraries;
-	const char* extra_flags;
+	const char* compile_flags;
+	const char* link_flags;
 } PlatformConfig;
 
-long time_stamps[512];
-long hashes[512];
-struct stat buff;
-int file_changed = 0;
-char name[512];
+// argv for one compiler invocation; arguments live in the inline storage
+typedef struct {
+	char* args[256];
+	int count;
+	char storage[8192];
+	size_t used;
+} Command;
+
+// One compile or link step run by the worker pool
+typedef struct {
+	Command cmd;
+	int target;
+	pid_t pid;
+	bool ok;
+	const BuildConfig* config;
+	const char* src;
+	char obj[512];
+} BuildJob;
+
+// Source files keyed by path, so adding or removing a file never disturbs
+// the state kept for the others
+typedef struct {
+	char path[256];
+	struct timespec mtime;
+	uint64_t hash;
+	bool changed;
+} WatchedFile;
+
+typedef struct {
+	int wd;
+	char path[256];
+} WatchedDir;
+
+#define MAX_WATCHED_FILES 1024
+#define MAX_WATCHED_DIRS 256
+
+// Reverse dependency graph: every source and header seen in a target's
+// -MMD output, with the targets that need rebuilding when it changes
+typedef struct {
+	char path[256];
+	uint32_t target_mask;
+} DependencyNode;
+
+#define MAX_DEPENDENCY_NODES 2048
+#define MAX_DEPENDENCIES 1024
+
+enum {
+	TARGET_MAIN_APP,
+	TARGET_ENGINE,
+	TARGET_RENDERER,
+	TARGET_ATLAS_PACKER,
+	TARGET_COUNT
+};
+
+// Targets main.c hot reloads; anything else needs a restart
+#define ENGINE_MODULE_TARGETS ((1u << TARGET_ENGINE) | (1u << TARGET_RENDERER))
+// Offline tools the game never loads; rebuilt without touching it
+#define TOOL_TARGETS (1u << TARGET_ATLAS_PACKER)
+
+// Named sets of optimisation flags; objects are kept per profile
+typedef struct {
+	const char* name;
+	const char* compile_flags;
+	const char* link_flags;
+} BuildProfile;
+
+#define BUILD_DIR ".build"
+#define PGO_DATA_DIR BUILD_DIR "/pgo-data"
+#define PGO_SESSION_FRAMES "600"
+#define MAX_BUILD_JOBS 64
+// Sprite images are packed into atlas pages the renderer loads at init
+#define SPRITE_SOURCE_DIR "assets/sprites"
+#define SPRITE_ATLAS_PREFIX "assets/atlas"
+
+WatchedFile watched_files[MAX_WATCHED_FILES];
+int watched_file_count = 0;
+WatchedDir watched_dirs[MAX_WATCHED_DIRS];
+int watched_dir_count = 0;
+int inotify_fd = -1;
 pid_t game_pid = -1;
-int current_file_index = 0;
+// With --keep-state the game keeps persistent memory in this file, so
+// restarting it after a main.c change resumes where it was
+#define GAME_STATE_FILE BUILD_DIR "/persistent_state.bin"
+bool keep_game_state = false;
 bool main_app_built = false;
+ReloadTimingShared* reload_timing = NULL;
+BuildJob build_jobs[MAX_BUILD_JOBS];
+DependencyNode dependency_nodes[MAX_DEPENDENCY_NODES];
+int dependency_node_count = 0;
+BuildConfig targets[TARGET_COUNT];
+const BuildProfile* build_profile = NULL;
+char obj_root[256];
+bool force_rebuild = false;
+char pgo_compile_flags[512];
+char pgo_link_flags[512];
+
+#if defined(PLATFORM_MAC)
+#define NATIVE_ARCH_FLAG "-mcpu=native"
+#define SPLIT_DWARF_FLAG ""
+#else
+#define NATIVE_ARCH_FLAG "-march=native"
+#define SPLIT_DWARF_FLAG " -gsplit-dwarf"
+#endif
+
+const BuildProfile build_profiles[] = {
+	{ "debug",        "-g -O0", "-g" },
+	{ "fast-iterate", "-g -O1" SPLIT_DWARF_FLAG, "-g" SPLIT_DWARF_FLAG },
+	{ "release",      "-O3 -DNDEBUG " NATIVE_ARCH_FLAG " -flto", "-O3 " NATIVE_ARCH_FLAG " -flto" },
+};
+#define BUILD_PROFILE_COUNT (int)(sizeof(build_profiles) / sizeof(build_profiles[0]))
+int worker_count = 1;
 
 const char* ignore_watch_dirs[] = {
 	".git",
@@ -53,6 +167,7 @@ const char* ignore_watch_dirs[] = {
 
 const char* main_src_files[] = {
     "main.c",
+	"snapshot.c",
 	"libs/glad/glad.c",
     NULL
 };
@@ -62,6 +177,25 @@ const char* engine_src_files[] = {
 	NULL
 };
 
+const char* renderer_src_files[] = {
+	"renderer.c",
+	NULL
+};
+
+const char* atlas_packer_src_files[] = {
+	"atlas_packer.c",
+	NULL
+};
+
+// Tools only use the engine's own headers and libc
+const char* tool_include_dirs[] = {
+	NULL
+};
+
+const char* tool_libraries[] = {
+	NULL
+};
+
 const char* main_include_dirs[] = {
 	"libs/SDL3/include",
 	"libs/glad",
@@ -123,11 +257,25 @@ const char* mac_engine_frameworks[] = {
 	NULL
 };
 
+// Hash a file's contents. Empty and unreadable files hash like empty input.
+uint64_t hash_file(const char* path) {
+	uint64_t hash = hash_bytes("", 0, HASH_SEED);
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0) {
+		return hash;
+	}
 
-/*	
-int hash (char*) {
+	struct stat file_stat;
+	if(fstat(fd, &file_stat) == 0 && file_stat.st_size > 0) {
+		void* data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(data != MAP_FAILED) {
+			hash = hash_bytes(data, file_stat.st_size, HASH_SEED);
+			munmap(data, file_stat.st_size);
+		}
+	}
+	close(fd);
+	return hash;
 }
-*/
 
 bool has_extension(const char *filename, const char *extension){
 	const char *dot = strrchr(filename,'.');
@@ -137,119 +285,962 @@ bool has_extension(const char *filename, const char *extension){
 	return strcmp(dot + 1, extension) == 0;
 }
 
-int display_info(const char *fpath, const struct stat *sb, int typeflag) {
+bool is_source_file(const char* path) {
+	return has_extension(path, "c") || has_extension(path, "h");
+}
+
+// Images the sprite atlas is packed from; the packed pages next to the
+// table are outputs and stay unwatched
+bool is_sprite_image(const char* path) {
+	size_t dir_length = strlen(SPRITE_SOURCE_DIR);
+	return strncmp(path, SPRITE_SOURCE_DIR "/", dir_length + 1) == 0 &&
+		(has_extension(path, "bmp") || has_extension(path, "tga"));
+}
+
+// Only sources and sprite images are tracked; binaries and staged libraries
+// churn constantly
+bool is_watched_file(const char* path) {
+	return is_source_file(path) || is_sprite_image(path);
+}
+
+bool is_ignored_path(const char* path) {
+	for(int i = 0; ignore_watch_dirs[i] != NULL; i++) {
+		if(strstr(path, ignore_watch_dirs[i]) != NULL) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Paths are stored without the leading "./" that ftw reports
+const char* normalize_path(const char* path) {
+	if(strncmp(path, "./", 2) == 0) {
+		path += 2;
+	}
+	return path;
+}
+
+WatchedFile* find_watched_file(const char* path) {
+	for(int i = 0; i < watched_file_count; i++) {
+		if(strcmp(watched_files[i].path, path) == 0) {
+			return &watched_files[i];
+		}
+	}
+	return NULL;
+}
+
+void forget_watched_file(const char* path) {
+	WatchedFile* file = find_watched_file(path);
+	if(file) {
+		*file = watched_files[--watched_file_count];
+	}
+}
+
+// Record the file's current mtime and content hash. Returns true if the file
+// is new or its contents changed; an mtime change alone is not enough.
+bool update_watched_file(const char* path, bool mark_changed) {
+	if(!is_watched_file(path)) {
+		return false;
+	}
+
+	struct stat file_stat;
+	if(stat(path, &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+		return false;
+	}
+
+	WatchedFile* file = find_watched_file(path);
+	if(file == NULL) {
+		if(watched_file_count == MAX_WATCHED_FILES) {
+			printf("Too many watched files, ignoring %s\n", path);
+			return false;
+		}
+		file = &watched_files[watched_file_count++];
+		snprintf(file->path, sizeof(file->path), "%s", path);
+		file->mtime = file_stat.st_mtim;
+		file->hash = hash_file(path);
+		file->changed = mark_changed;
+		return mark_changed;
+	}
+
+	if(file->mtime.tv_sec == file_stat.st_mtim.tv_sec &&
+	   file->mtime.tv_nsec == file_stat.st_mtim.tv_nsec) {
+		return false;
+	}
+	file->mtime = file_stat.st_mtim;
+
+	uint64_t hash = hash_file(path);
+	if(hash == file->hash) {
+		printf("%s saved without changes, skipping rebuild\n", path);
+		return false;
+	}
+	file->hash = hash;
+	file->changed = file->changed || mark_changed;
+	return mark_changed;
+}
+
+#if defined(__linux__)
+bool watch_directory(const char* path) {
+	if(watched_dir_count == MAX_WATCHED_DIRS) {
+		printf("Too many watched directories, ignoring %s\n", path);
+		return false;
+	}
+	int wd = inotify_add_watch(inotify_fd, path,
+		IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE | IN_ONLYDIR);
+	if(wd < 0) {
+		perror(path);
+		return false;
+	}
+	for(int i = 0; i < watched_dir_count; i++) {
+		if(watched_dirs[i].wd == wd) {
+			return true;
+		}
+	}
+	watched_dirs[watched_dir_count].wd = wd;
+	snprintf(watched_dirs[watched_dir_count].path, sizeof(watched_dirs[watched_dir_count].path), "%s", path);
+	watched_dir_count++;
+	return true;
+}
+
+const char* watched_directory_path(int wd) {
+	for(int i = 0; i < watched_dir_count; i++) {
+		if(watched_dirs[i].wd == wd) {
+			return watched_dirs[i].path;
+		}
+	}
+	return NULL;
+}
+
+void forget_watched_directory(int wd) {
+	for(int i = 0; i < watched_dir_count; i++) {
+		if(watched_dirs[i].wd == wd) {
+			watched_dirs[i] = watched_dirs[--watched_dir_count];
+			return;
+		}
+	}
+}
+#endif
+
+// Set when a sprite image is deleted or moved away, which only shows as a
+// forgotten file
+bool sprite_image_removed = false;
+
+// ftw callbacks: the initial scan records files quietly, later scans
+// (new directories, or polling without inotify) flag what they find
+bool scan_marks_changes = false;
+
+int scan_entry(const char *fpath, const struct stat *sb, int typeflag) {
+	(void)sb;
+	const char* path = normalize_path(fpath);
 	if(strcmp(".", fpath) == 0) {
+#if defined(__linux__)
+		watch_directory(".");
+#endif
+		return 0;
+	}
+	if(is_ignored_path(path)) {
 		return 0;
 	}
 
-	const char* path_to_check = fpath;
-	if(strncmp(path_to_check, "./", 2) == 0) {
-		path_to_check += 2;
+	if(typeflag == FTW_D) {
+#if defined(__linux__)
+		watch_directory(path);
+#endif
+	} else if(typeflag == FTW_F) {
+		update_watched_file(path, scan_marks_changes);
 	}
+	return 0;
+}
 
-	for(int i = 0; ignore_watch_dirs[i] != NULL; i++) {
-		char skipped_dir_name_len = strlen(ignore_watch_dirs[i]);
-		char *dir_pos = strstr(path_to_check, ignore_watch_dirs[i]);
-		if(dir_pos != NULL) {
-			return 0;
+bool start_source_watcher() {
+#if defined(__linux__)
+	inotify_fd = inotify_init1(IN_CLOEXEC);
+	if(inotify_fd < 0) {
+		perror("inotify_init1");
+		return false;
+	}
+#endif
+	scan_marks_changes = false;
+	ftw(".", scan_entry, 20);
+	printf("Watching %d files in %d directories\n", watched_file_count, watched_dir_count);
+	return true;
+}
+
+#if defined(__linux__)
+// Apply one batch of inotify events to the watch tables
+bool process_source_events(const char* buffer, ssize_t len) {
+	bool any_changed = false;
+
+	for(const char* ptr = buffer; ptr < buffer + len; ) {
+		const struct inotify_event* event = (const struct inotify_event*)ptr;
+		ptr += sizeof(struct inotify_event) + event->len;
+
+		if(event->mask & IN_IGNORED) {
+			forget_watched_directory(event->wd);
+			continue;
+		}
+
+		const char* dir = watched_directory_path(event->wd);
+		if(dir == NULL || event->len == 0) {
+			continue;
+		}
+
+		char path[512];
+		if(strcmp(dir, ".") == 0) {
+			snprintf(path, sizeof(path), "%s", event->name);
+		} else {
+			snprintf(path, sizeof(path), "%s/%s", dir, event->name);
+		}
+		if(is_ignored_path(path)) {
+			continue;
+		}
+
+		if(event->mask & IN_ISDIR) {
+			if(event->mask & (IN_CREATE | IN_MOVED_TO)) {
+				// Pick up the new subtree and anything written into it already
+				scan_marks_changes = true;
+				ftw(path, scan_entry, 20);
+				any_changed = true;
+			}
+		} else if(event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+			forget_watched_file(path);
+			if(is_sprite_image(path)) {
+				sprite_image_removed = true;
+				any_changed = true;
+			}
+		} else if(event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+			if(update_watched_file(path, true)) {
+				any_changed = true;
+			}
 		}
 	}
+	return any_changed;
+}
+#endif
 
-	int file_index = current_file_index++;
-	if(stat(fpath,&buff) == 0) {
-		if(time_stamps[file_index] != buff.st_mtime) {
-			if(has_extension(fpath, "c")){
-			strcpy(name,fpath);
-			time_stamps[file_index] = buff.st_mtime;
-			file_changed = 1;
-			return 1;
+// Sleep until at least one watched file really changed. Editors often write
+// several times per save, so keep collecting until things are quiet again.
+void wait_for_source_changes() {
+#if defined(__linux__)
+	char buffer[16 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+	bool any_changed = false;
+	int timeout = -1;
+
+	while(true) {
+		struct pollfd pfd = { .fd = inotify_fd, .events = POLLIN };
+		int ready = poll(&pfd, 1, timeout);
+		if(ready < 0) {
+			if(errno == EINTR) {
+				continue;
 			}
+			perror("poll");
+			return;
+		}
+		if(ready == 0) {
+			return;
+		}
+
+		ssize_t len = read(inotify_fd, buffer, sizeof(buffer));
+		if(len <= 0) {
+			continue;
+		}
+		if(process_source_events(buffer, len)) {
+			any_changed = true;
 		}
+		timeout = any_changed ? 20 : -1;
+	}
+#else
+	// No inotify: rescan at a relaxed interval, still keyed by path
+	while(true) {
+		usleep(100000);
+		scan_marks_changes = true;
+		ftw(".", scan_entry, 20);
+		for(int i = 0; i < watched_file_count; i++) {
+			if(watched_files[i].changed) {
+				return;
+			}
+		}
+	}
+#endif
+}
+
+void record_reload_stage(ReloadStage stage, int64_t stamp) {
+	if(reload_timing) {
+		reload_timing->stamps[stage] = stamp;
+	}
+}
+
+// Make the stamps visible to the engine once the library is on disk
+void publish_reload_timing() {
+	if(reload_timing) {
+		__sync_synchronize();
+		reload_timing->sequence++;
 	}
-	return 0;
 }
 
-void concat_list(char* compile_cmd, char* prefix,const char** list) {
+void command_add(Command* cmd, const char* prefix, const char* arg) {
+	size_t prefix_len = prefix ? strlen(prefix) : 0;
+	size_t arg_len = strlen(arg);
+	if(cmd->count >= (int)(sizeof(cmd->args) / sizeof(cmd->args[0])) - 1 ||
+	   cmd->used + prefix_len + arg_len + 1 > sizeof(cmd->storage)) {
+		printf("Command too long, dropping argument %s\n", arg);
+		return;
+	}
+
+	char* dst = cmd->storage + cmd->used;
+	if(prefix_len) {
+		memcpy(dst, prefix, prefix_len);
+	}
+	memcpy(dst + prefix_len, arg, arg_len + 1);
+	cmd->used += prefix_len + arg_len + 1;
+	cmd->args[cmd->count++] = dst;
+	cmd->args[cmd->count] = NULL;
+}
+
+void command_add_list(Command* cmd, const char* prefix, const char** list) {
 	for(int i = 0; list[i] != NULL; i++) {
-		strcat(compile_cmd, " ");
-		if(prefix != NULL) {
-			strcat(compile_cmd, prefix);
+		command_add(cmd, prefix, list[i]);
+	}
+}
+
+// Split a space separated flag string into separate arguments
+void command_add_flags(Command* cmd, const char* flags) {
+	char flag[512];
+	while(flags && *flags) {
+		while(*flags == ' ') {
+			flags++;
 		}
-		strcat(compile_cmd, list[i]);
+		size_t len = strcspn(flags, " ");
+		if(len > 0 && len < sizeof(flag)) {
+			memcpy(flag, flags, len);
+			flag[len] = '\0';
+			command_add(cmd, NULL, flag);
+		}
+		flags += len;
 	}
 }
 
+void command_print(const Command* cmd) {
+	printf("Building:");
+	for(int i = 0; i < cmd->count; i++) {
+		printf(" %s", cmd->args[i]);
+	}
+	printf("\n");
+}
+
 PlatformConfig get_platform_config() {
 	PlatformConfig config = {0};
 
 #if defined (PLATFORM_LINUX_X64)
 	config.lib_files = linux_lib_files;
 	config.libraries = linux_libraries;
-	config.extra_flags = "-Wl,-rpath,'$ORIGIN'";
+	config.link_flags = "-Wl,-rpath,$ORIGIN";
 #elif defined (PLATFORM_MAC_ARM)
 	config.lib_files = mac_arm_lib_files;
 	config.libraries = mac_arm_libraries;
-	config.extra_flags = "-arch arm64 -mmacosx-version-min=15.0";
+	config.compile_flags = "-arch arm64 -mmacosx-version-min=15.0";
+	config.link_flags = "-arch arm64 -mmacosx-version-min=15.0";
 #else
 #error "Unsupported platform"
 #endif
 	return config;
 }
 
-bool build_targe(const BuildConfig* config) {
-	char compile_cmd[2048] ="";
+bool make_directories(const char* path) {
+	char partial[512];
+	snprintf(partial, sizeof(partial), "%s", path);
+	for(char* p = partial + 1; ; p++) {
+		if(*p == '/' || *p == '\0') {
+			char saved = *p;
+			*p = '\0';
+			if(mkdir(partial, 0755) != 0 && errno != EEXIST) {
+				perror(partial);
+				return false;
+			}
+			*p = saved;
+			if(saved == '\0') {
+				return true;
+			}
+		}
+	}
+}
 
+// build/obj/<target>/<source path with '/' flattened>.o
+void object_path(const BuildConfig* config, const char* src, char* out, size_t out_size) {
+	char flattened[256];
+	snprintf(flattened, sizeof(flattened), "%s", src);
+	for(char* p = flattened; *p; p++) {
+		if(*p == '/') {
+			*p = '_';
+		}
+	}
+	char* dot = strrchr(flattened, '.');
+	if(dot) {
+		*dot = '\0';
+	}
+	snprintf(out, out_size, "%s/%s/%s.o", obj_root, config->output_name, flattened);
+}
+
+bool is_newer(const struct stat* a, const struct stat* b) {
+	if(a->st_mtim.tv_sec != b->st_mtim.tv_sec) {
+		return a->st_mtim.tv_sec > b->st_mtim.tv_sec;
+	}
+	return a->st_mtim.tv_nsec >= b->st_mtim.tv_nsec;
+}
+
+// x.o -> x.d, written by the compiler's -MMD
+void dependency_path(const char* obj, char* out, size_t out_size) {
+	snprintf(out, out_size, "%s", obj);
+	size_t len = strlen(out);
+	if(len > 0) {
+		out[len - 1] = 'd';
+	}
+}
+
+// Split a make-style .d file into its prerequisites. `buffer` receives the
+// file contents and `deps` points into it. Returns -1 if it can't be read.
+int parse_dependency_file(const char* dep_file, char* buffer, size_t size, char** deps, int max_deps) {
+	FILE* file = fopen(dep_file, "r");
+	if(file == NULL) {
+		return -1;
+	}
+	size_t len = fread(buffer, 1, size - 1, file);
+	bool truncated = !feof(file);
+	fclose(file);
+	if(truncated) {
+		return -1;
+	}
+	buffer[len] = '\0';
+
+	char* p = strchr(buffer, ':');
+	if(p == NULL) {
+		return -1;
+	}
+	p++;
+
+	int count = 0;
+	while(*p) {
+		while(*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' || (*p == '\\' && (p[1] == '\n' || p[1] == '\r'))) {
+			p++;
+		}
+		if(*p == '\0') {
+			break;
+		}
+		char* start = p;
+		while(*p && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r') {
+			p++;
+		}
+		if(*p) {
+			*p++ = '\0';
+		}
+		if(count == max_deps) {
+			return -1;
+		}
+		deps[count++] = (char*)normalize_path(start);
+	}
+	return count;
+}
+
+// Watched files already know their hash; everything else is read from disk
+uint64_t cached_file_hash(const char* path) {
+	WatchedFile* file = find_watched_file(normalize_path(path));
+	return file ? file->hash : hash_file(path);
+}
+
+// Hash of a translation unit: its source plus every header it included last
+// time it was compiled. Returns 0 if the dependency list is unavailable.
+uint64_t translation_unit_hash(const char* src, const char* obj) {
+	char dep_file[512];
+	dependency_path(obj, dep_file, sizeof(dep_file));
+
+	static char buffer[64 * 1024];
+	static char* deps[MAX_DEPENDENCIES];
+	int count = parse_dependency_file(dep_file, buffer, sizeof(buffer), deps, MAX_DEPENDENCIES);
+	if(count < 0) {
+		return 0;
+	}
+
+	uint64_t hash = cached_file_hash(src);
+	for(int i = 0; i < count; i++) {
+		if(strcmp(deps[i], normalize_path(src)) == 0) {
+			continue;
+		}
+		uint64_t dep_hash = cached_file_hash(deps[i]);
+		hash = hash_bytes(&dep_hash, sizeof(dep_hash), hash);
+	}
+	return hash;
+}
+
+// Objects carry a sidecar with the translation unit hash they were built
+// from, so a touched but unchanged source or header reuses its object
+void object_hash_path(const char* obj, char* out, size_t out_size) {
+	snprintf(out, out_size, "%s.hash", obj);
+}
+
+uint64_t read_object_hash(const char* obj) {
+	char hash_path[512];
+	object_hash_path(obj, hash_path, sizeof(hash_path));
+	FILE* file = fopen(hash_path, "r");
+	if(file == NULL) {
+		return 0;
+	}
+	unsigned long long hash = 0;
+	if(fscanf(file, "%llx", &hash) != 1) {
+		hash = 0;
+	}
+	fclose(file);
+	return hash;
+}
+
+void write_object_hash(const char* obj, uint64_t hash) {
+	char hash_path[512];
+	object_hash_path(obj, hash_path, sizeof(hash_path));
+	FILE* file = fopen(hash_path, "w");
+	if(file) {
+		fprintf(file, "%016llx\n", (unsigned long long)hash);
+		fclose(file);
+	}
+}
+
+// The precompiled header lives next to the target's objects. Compilers pick
+// up `<header>.gch` (`.pch` for clang) when the TU is given `-include <header>`
+// with that path, so the include path is the output minus its extension.
+void pch_include_path(const BuildConfig* config, char* out, size_t out_size) {
+	snprintf(out, out_size, "%s/%s/pch/%s", obj_root, config->output_name, config->pch_header);
+}
+
+void pch_output_path(const BuildConfig* config, char* out, size_t out_size) {
+	char include_path[512];
+	pch_include_path(config, include_path, sizeof(include_path));
+#if defined(PLATFORM_MAC)
+	snprintf(out, out_size, "%s.pch", include_path);
+#else
+	snprintf(out, out_size, "%s.gch", include_path);
+#endif
+}
+
+// Object key: the translation unit hash, mixed with the compile command that
+// builds the object and with the precompiled header's key when the target
+// uses one. build.c is rebuilt on every run, so the command covers edited
+// flags, defines and include directories. The compiler doesn't list the PCH
+// or the headers inside it in the TU's .d file, so without its key an edit
+// to the umbrella header would leave stale objects behind.
+uint64_t object_key(const BuildConfig* config, const char* src, const char* obj, const Command* cmd) {
+	uint64_t hash = translation_unit_hash(src, obj);
+	if(hash == 0) {
+		return 0;
+	}
+	// Arguments sit back to back in the storage, each ending in a NUL
+	hash = hash_bytes(cmd->storage, cmd->used, hash);
+	if(config != NULL && config->pch_header != NULL) {
+		char pch[512];
+		pch_output_path(config, pch, sizeof(pch));
+		uint64_t pch_hash = read_object_hash(pch);
+		hash = hash_bytes(&pch_hash, sizeof(pch_hash), hash);
+	}
+	return hash;
+}
+
+bool object_up_to_date(const BuildConfig* config, const char* src, const char* obj, const Command* cmd) {
+	struct stat obj_stat;
+	if(force_rebuild || stat(obj, &obj_stat) != 0) {
+		return false;
+	}
+	uint64_t hash = object_key(config, src, obj, cmd);
+	return hash != 0 && read_object_hash(obj) == hash;
+}
+
+void add_dependency(const char* path, int target) {
+	for(int i = 0; i < dependency_node_count; i++) {
+		if(strcmp(dependency_nodes[i].path, path) == 0) {
+			dependency_nodes[i].target_mask |= 1u << target;
+			return;
+		}
+	}
+	if(dependency_node_count == MAX_DEPENDENCY_NODES) {
+		return;
+	}
+	DependencyNode* node = &dependency_nodes[dependency_node_count++];
+	snprintf(node->path, sizeof(node->path), "%s", path);
+	node->target_mask = 1u << target;
+}
+
+// Rebuild the reverse graph from every object's .d file
+void update_dependency_graph() {
+	static char buffer[64 * 1024];
+	static char* deps[MAX_DEPENDENCIES];
+
+	dependency_node_count = 0;
+	for(int t = 0; t < TARGET_COUNT; t++) {
+		const BuildConfig* config = &targets[t];
+		for(int i = 0; config->src_files[i] != NULL; i++) {
+			add_dependency(normalize_path(config->src_files[i]), t);
+
+			char obj[512], dep_file[512];
+			object_path(config, config->src_files[i], obj, sizeof(obj));
+			dependency_path(obj, dep_file, sizeof(dep_file));
+			int count = parse_dependency_file(dep_file, buffer, sizeof(buffer), deps, MAX_DEPENDENCIES);
+			for(int d = 0; d < count; d++) {
+				add_dependency(deps[d], t);
+			}
+		}
+
+		if(config->pch_header) {
+			char pch[512], dep_file[512];
+			pch_output_path(config, pch, sizeof(pch));
+			dependency_path(pch, dep_file, sizeof(dep_file));
+			add_dependency(normalize_path(config->pch_header), t);
+			int count = parse_dependency_file(dep_file, buffer, sizeof(buffer), deps, MAX_DEPENDENCIES);
+			for(int d = 0; d < count; d++) {
+				add_dependency(deps[d], t);
+			}
+		}
+	}
+}
+
+uint32_t targets_depending_on(const char* path) {
+	for(int i = 0; i < dependency_node_count; i++) {
+		if(strcmp(dependency_nodes[i].path, path) == 0) {
+			return dependency_nodes[i].target_mask;
+		}
+	}
+	return 0;
+}
+
+const char* compiler_name() {
 #if defined (PLATFORM_MAC)
-	strcat(compile_cmd, "clang");
+	return "clang";
 #else
-	strcat(compile_cmd, "gcc");
+	return "gcc";
 #endif
+}
+
+Command* add_build_job(int* job_count, int target) {
+	if(*job_count >= MAX_BUILD_JOBS) {
+		printf("Too many build jobs, increase MAX_BUILD_JOBS\n");
+		return NULL;
+	}
+	BuildJob* job = &build_jobs[(*job_count)++];
+	memset(&job->cmd, 0, sizeof(job->cmd));
+	job->target = target;
+	job->pid = -1;
+	job->ok = false;
+	job->obj[0] = '\0';
+	job->config = NULL;
+	job->src = NULL;
+	return &job->cmd;
+}
 
-	strcat(compile_cmd," -std=c99 -Wall -Wextra -g -O0");
+// Flags shared by translation units and the precompiled header; a PCH is only
+// accepted by compiles that use the same ones
+Command* add_compiler_job(int* job_count, int target, const BuildConfig* config, const char* src, const char* obj) {
+	Command* cmd = add_build_job(job_count, target);
+	if(cmd == NULL) {
+		return NULL;
+	}
+	BuildJob* job = &build_jobs[*job_count - 1];
+	snprintf(job->obj, sizeof(job->obj), "%s", obj);
+	job->config = config;
+	job->src = src;
+
+	char dep_file[512];
+	dependency_path(obj, dep_file, sizeof(dep_file));
+	command_add(cmd, NULL, compiler_name());
+	command_add_flags(cmd, "-std=c99 -Wall -Wextra");
+	command_add_flags(cmd, build_profile->compile_flags);
+	if(config->is_shared_lib) {
+		command_add(cmd, NULL, "-fPIC");
+	}
+	if(config->compile_flags) {
+		command_add_flags(cmd, config->compile_flags);
+	}
+	command_add_list(cmd, "-I", config->include_dirs);
+	command_add(cmd, NULL, "-MMD");
+	command_add(cmd, NULL, "-MF");
+	command_add(cmd, NULL, dep_file);
+	return cmd;
+}
+
+void add_compile_job(int* job_count, int target, const BuildConfig* config, const char* src, const char* obj) {
+	Command* cmd = add_compiler_job(job_count, target, config, src, obj);
+	if(cmd == NULL) {
+		return;
+	}
+	if(config->pch_header) {
+		char include_path[512];
+		pch_include_path(config, include_path, sizeof(include_path));
+		command_add(cmd, NULL, "-include");
+		command_add(cmd, NULL, include_path);
+	}
+	command_add(cmd, NULL, "-c");
+	command_add(cmd, NULL, src);
+	command_add(cmd, NULL, "-o");
+	command_add(cmd, NULL, obj);
+}
+
+void add_pch_job(int* job_count, int target, const BuildConfig* config, const char* pch) {
+	Command* cmd = add_compiler_job(job_count, target, config, config->pch_header, pch);
+	if(cmd == NULL) {
+		return;
+	}
+	command_add(cmd, NULL, "-x");
+	command_add(cmd, NULL, "c-header");
+	command_add(cmd, NULL, config->pch_header);
+	command_add(cmd, NULL, "-o");
+	command_add(cmd, NULL, pch);
+}
+
+void add_link_job(int* job_count, int target, const BuildConfig* config) {
+	Command* cmd = add_build_job(job_count, target);
+	if(cmd == NULL) {
+		return;
+	}
+	command_add(cmd, NULL, compiler_name());
+	command_add_flags(cmd, build_profile->link_flags);
 
 	if(config->is_shared_lib) {
 #if defined(PLATFORM_MAC)
-		strcat(compile_cmd, " -dynamiclib");
+		command_add(cmd, NULL, "-dynamiclib");
+		command_add(cmd, NULL, "-install_name");
+		command_add(cmd, "@rpath/", config->output_name);
+		command_add_flags(cmd, "-undefined dynamic_lookup");
 #else
-		strcat(compile_cmd, " -fPIC -shared");
+		command_add(cmd, NULL, "-shared");
 #endif
 	}
 
-	if(config->extra_flags) {
-		strcat(compile_cmd, " ");
-		strcat(compile_cmd, config->extra_flags);
+	if(config->link_flags) {
+		command_add_flags(cmd, config->link_flags);
 	}
 
-	strcat(compile_cmd, " -o ");
-	strcat(compile_cmd, config->output_name);
+	command_add(cmd, NULL, "-o");
+	command_add(cmd, NULL, config->output_name);
 
-	concat_list(compile_cmd, " ", config->src_files);
-	concat_list(compile_cmd, "-I", config->include_dirs);
+	for(int i = 0; config->src_files[i] != NULL; i++) {
+		char obj[512];
+		object_path(config, config->src_files[i], obj, sizeof(obj));
+		command_add(cmd, NULL, obj);
+	}
 
 	if(config->lib_files) {
-		concat_list(compile_cmd, " ", config->lib_files);
+		command_add_list(cmd, NULL, config->lib_files);
 	}
 
 #if defined (PLATFORM_MAC)
-	if(!config->is_shared_lib) {
-		concat_list(compile_cmd, "-framework ", mac_frameworks);
-	} else {
-		concat_list(compile_cmd, "-framework ", mac_engine_frameworks);
+	const char** frameworks = config->is_shared_lib ? mac_engine_frameworks : mac_frameworks;
+	for(int i = 0; frameworks[i] != NULL; i++) {
+		command_add(cmd, NULL, "-framework");
+		command_add(cmd, NULL, frameworks[i]);
 	}
 #endif
 
-	concat_list(compile_cmd, " -l", config->libraries);
-	
-	printf("Building: %s\n",compile_cmd);
-	int result = system(compile_cmd);
+	command_add_list(cmd, "-l", config->libraries);
+}
 
-	if(result == 0) {
-        printf("✓ %s built successfully\n", config->output_name);
-        return true;
-    } else {
-        printf("✗ %s build failed\n", config->output_name);
-        return false;
-    }
+// Run jobs on a fork/exec pool of worker_count processes
+bool run_build_jobs(int job_count) {
+	int next = 0;
+	int running = 0;
+	bool all_ok = true;
+
+	while(next < job_count || running > 0) {
+		while(running < worker_count && next < job_count) {
+			BuildJob* job = &build_jobs[next++];
+			command_print(&job->cmd);
+			job->pid = fork();
+			if(job->pid == 0) {
+				execvp(job->cmd.args[0], job->cmd.args);
+				perror("Failed to start compiler");
+				_exit(127);
+			} else if(job->pid < 0) {
+				perror("Failed to fork");
+				all_ok = false;
+			} else {
+				running++;
+			}
+		}
+
+		if(running == 0) {
+			continue;
+		}
+
+		int status;
+		pid_t pid = waitpid(-1, &status, 0);
+		if(pid < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			perror("waitpid");
+			return false;
+		}
+
+		// The game is our child too; notice if it went away
+		if(pid == game_pid) {
+			printf("Game process %d exited\n", game_pid);
+			game_pid = -1;
+			continue;
+		}
+
+		for(int i = 0; i < next; i++) {
+			if(build_jobs[i].pid == pid) {
+				build_jobs[i].ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+				build_jobs[i].pid = -1;
+				all_ok = all_ok && build_jobs[i].ok;
+				running--;
+				break;
+			}
+		}
+	}
+	return all_ok;
+}
+
+// Outputs are shared between profiles, so remember which profile linked them
+void link_stamp_path(const BuildConfig* config, char* out, size_t out_size) {
+	snprintf(out, out_size, "%s/%s.profile", BUILD_DIR, config->output_name);
+}
+
+bool linked_with_current_profile(const BuildConfig* config) {
+	char path[512], linked[64] = "";
+	link_stamp_path(config, path, sizeof(path));
+	FILE* file = fopen(path, "r");
+	if(file == NULL) {
+		return false;
+	}
+	bool read_ok = fscanf(file, "%63s", linked) == 1;
+	fclose(file);
+	return read_ok && strcmp(linked, build_profile->name) == 0;
+}
+
+void record_link_profile(const BuildConfig* config) {
+	char path[512];
+	link_stamp_path(config, path, sizeof(path));
+	FILE* file = fopen(path, "w");
+	if(file) {
+		fprintf(file, "%s\n", build_profile->name);
+		fclose(file);
+	}
+}
+
+// Compile every out of date translation unit of all targets in parallel,
+// then link the targets whose objects changed
+bool build_targets(const BuildConfig** configs, int target_count) {
+	bool needs_link[16] = {0};
+	bool target_ok[16];
+	int job_count = 0;
+	int total_units = 0;
+
+	// Precompiled headers first: every translation unit of the target
+	// includes them and their key is part of each object key
+	for(int t = 0; t < target_count; t++) {
+		const BuildConfig* config = configs[t];
+		target_ok[t] = true;
+		if(config->pch_header == NULL) {
+			continue;
+		}
+
+		char pch_dir[512], pch[512];
+		snprintf(pch_dir, sizeof(pch_dir), "%s/%s/pch", obj_root, config->output_name);
+		if(!make_directories(pch_dir)) {
+			return false;
+		}
+		pch_output_path(config, pch, sizeof(pch));
+		// The job is set up first since its command is part of the key,
+		// and dropped again if the header is current
+		int job = job_count;
+		add_pch_job(&job_count, t, config, pch);
+		if(job < job_count && object_up_to_date(NULL, config->pch_header, pch, &build_jobs[job].cmd)) {
+			job_count = job;
+		}
+	}
+
+	if(job_count > 0) {
+		printf("Precompiling %d header%s\n", job_count, job_count == 1 ? "" : "s");
+		run_build_jobs(job_count);
+		for(int i = 0; i < job_count; i++) {
+			if(!build_jobs[i].ok) {
+				target_ok[build_jobs[i].target] = false;
+			} else {
+				write_object_hash(build_jobs[i].obj, object_key(NULL, build_jobs[i].src, build_jobs[i].obj, &build_jobs[i].cmd));
+			}
+		}
+		job_count = 0;
+	}
+
+	for(int t = 0; t < target_count; t++) {
+		const BuildConfig* config = configs[t];
+		if(!target_ok[t]) {
+			continue;
+		}
+
+		char obj_dir[512];
+		snprintf(obj_dir, sizeof(obj_dir), "%s/%s", obj_root, config->output_name);
+		if(!make_directories(obj_dir)) {
+			return false;
+		}
+
+		struct stat output_stat;
+		bool have_output = stat(config->output_name, &output_stat) == 0;
+		needs_link[t] = !have_output || !linked_with_current_profile(config);
+
+		for(int i = 0; config->src_files[i] != NULL; i++) {
+			char obj[512];
+			object_path(config, config->src_files[i], obj, sizeof(obj));
+			total_units++;
+
+			int job = job_count;
+			add_compile_job(&job_count, t, config, config->src_files[i], obj);
+			if(job == job_count || !object_up_to_date(config, config->src_files[i], obj, &build_jobs[job].cmd)) {
+				needs_link[t] = true;
+			} else {
+				job_count = job;
+				struct stat obj_stat;
+				if(have_output && stat(obj, &obj_stat) == 0 && !is_newer(&output_stat, &obj_stat)) {
+					needs_link[t] = true;
+				}
+			}
+		}
+	}
+
+	printf("Compiling %d of %d translation units on %d workers\n", job_count, total_units, worker_count);
+	run_build_jobs(job_count);
+	for(int i = 0; i < job_count; i++) {
+		if(!build_jobs[i].ok) {
+			target_ok[build_jobs[i].target] = false;
+		} else {
+			// Hash against the freshly written dependency list
+			write_object_hash(build_jobs[i].obj, object_key(build_jobs[i].config, build_jobs[i].src, build_jobs[i].obj, &build_jobs[i].cmd));
+		}
+	}
+	record_reload_stage(RELOAD_STAGE_COMPILE_DONE, reload_timing_now());
+
+	job_count = 0;
+	for(int t = 0; t < target_count; t++) {
+		if(target_ok[t] && needs_link[t]) {
+			add_link_job(&job_count, t, configs[t]);
+		}
+	}
+	run_build_jobs(job_count);
+	for(int i = 0; i < job_count; i++) {
+		if(!build_jobs[i].ok) {
+			target_ok[build_jobs[i].target] = false;
+		} else {
+			record_link_profile(configs[build_jobs[i].target]);
+		}
+	}
+
+	update_dependency_graph();
+
+	bool all_ok = true;
+	for(int t = 0; t < target_count; t++) {
+		if(!target_ok[t]) {
+			printf("✗ %s build failed\n", configs[t]->output_name);
+			all_ok = false;
+		} else if(needs_link[t]) {
+			printf("✓ %s built successfully\n", configs[t]->output_name);
+		} else {
+			printf("✓ %s is up to date\n", configs[t]->output_name);
+		}
+	}
+	return all_ok;
 }
 
 void kill_game_process() {
@@ -282,7 +1273,11 @@ void start_main_app() {
 	printf("Starting hot reload engine\n");
 	game_pid = fork();
 	if(game_pid == 0) {
-		execl("./hot_reload_engine", "./hot_reload_engine", NULL);
+		if(keep_game_state) {
+			execl("./hot_reload_engine", "./hot_reload_engine", "--state-file", GAME_STATE_FILE, NULL);
+		} else {
+			execl("./hot_reload_engine", "./hot_reload_engine", NULL);
+		}
         perror("Failed to start hot reload engine");
         exit(1);
     } else if(game_pid < 0) {
@@ -292,7 +1287,7 @@ void start_main_app() {
         printf("Started with PID %d\n", game_pid);
     }
 }
-bool build_main_app() {
+BuildConfig main_app_config() {
 	PlatformConfig platform = get_platform_config();
 
 	BuildConfig main_config = {
@@ -301,37 +1296,245 @@ bool build_main_app() {
 		.lib_files = platform.lib_files,
 		.libraries = platform.libraries,
 		.output_name = "hot_reload_engine",
-		.extra_flags = platform.extra_flags,
+		.compile_flags = platform.compile_flags,
+		.link_flags = platform.link_flags,
 		.is_shared_lib = false
 	};
-
-	return build_targe(&main_config);
+	return main_config;
 }
 
-bool build_engine() {
-	const char* output_name;
-	const char* extra_flags = NULL;
+// Engine modules are shared libraries loaded and reloaded by main.c
+BuildConfig engine_module_config(const char* output_name, const char** src_files) {
 	const char** libraries;
 
 #if defined(PLATFORM_MAC)
-	output_name = "libengine.dylib";
-	extra_flags = "-install_name @rpath/libengine.dylib -undefined dynamic_lookup";
 	libraries = mac_engine_libraries;
 #else
-	output_name = "libengine.so";
 	libraries = engine_libraries;
 #endif
 	BuildConfig engine_config = {
-		.src_files = engine_src_files,
+		.src_files = src_files,
 		.include_dirs = engine_include_dirs,
 		.lib_files = NULL,
 		.libraries = libraries,
 		.output_name = output_name,
-		.extra_flags = extra_flags,
+		.compile_flags = NULL,
+		.link_flags = NULL,
+		.pch_header = "engine_pch.h",
 		.is_shared_lib = true
 	};
+	return engine_config;
+}
+
+// Command line tools for the asset pipeline, run by build rather than the game
+BuildConfig tool_config(const char* output_name, const char** src_files) {
+	BuildConfig tool = {
+		.src_files = src_files,
+		.include_dirs = tool_include_dirs,
+		.lib_files = NULL,
+		.libraries = tool_libraries,
+		.output_name = output_name,
+		.compile_flags = NULL,
+		.link_flags = NULL,
+		.is_shared_lib = false
+	};
+	return tool;
+}
+
+void init_targets() {
+	targets[TARGET_MAIN_APP] = main_app_config();
+	targets[TARGET_ENGINE] = engine_module_config("libengine" DYLIB_EXTENSION, engine_src_files);
+	targets[TARGET_RENDERER] = engine_module_config("librenderer" DYLIB_EXTENSION, renderer_src_files);
+	targets[TARGET_ATLAS_PACKER] = tool_config("atlas_packer", atlas_packer_src_files);
+}
+
+// Build every target whose bit is set in `mask`, sharing one worker pool
+bool build_target_mask(uint32_t mask) {
+	const BuildConfig* configs[TARGET_COUNT];
+	int count = 0;
+	for(int t = 0; t < TARGET_COUNT; t++) {
+		if(mask & (1u << t)) {
+			configs[count++] = &targets[t];
+		}
+	}
+	return count == 0 || build_targets(configs, count);
+}
+
+bool build_all() {
+	return build_target_mask((1u << TARGET_COUNT) - 1);
+}
+
+void use_build_profile(const BuildProfile* profile) {
+	build_profile = profile;
+	snprintf(obj_root, sizeof(obj_root), "%s/%s/obj", BUILD_DIR, profile->name);
+	printf("Build profile: %s (%s)\n", profile->name, profile->compile_flags);
+}
+
+const BuildProfile* find_build_profile(const char* name) {
+	for(int i = 0; i < BUILD_PROFILE_COUNT; i++) {
+		if(strcmp(build_profiles[i].name, name) == 0) {
+			return &build_profiles[i];
+		}
+	}
+	return NULL;
+}
+
+// Repack the sprite atlas when the packer, the image directory or any image
+// in it is newer than the atlas table. Projects without the directory have
+// nothing to pack.
+bool pack_sprite_atlas() {
+	DIR* dir = opendir(SPRITE_SOURCE_DIR);
+	if(dir == NULL) {
+		return true;
+	}
+
+	struct stat atlas_stat, input_stat;
+	bool stale = stat(SPRITE_ATLAS_PREFIX ".atlas", &atlas_stat) != 0;
+	if(!stale && stat("./atlas_packer", &input_stat) == 0 && is_newer(&input_stat, &atlas_stat)) {
+		stale = true;
+	}
+	// Removing an image only changes the directory
+	if(!stale && stat(SPRITE_SOURCE_DIR, &input_stat) == 0 && is_newer(&input_stat, &atlas_stat)) {
+		stale = true;
+	}
+	struct dirent* entry;
+	while(!stale && (entry = readdir(dir)) != NULL) {
+		if(!has_extension(entry->d_name, "bmp") && !has_extension(entry->d_name, "tga")) {
+			continue;
+		}
+		char path[512];
+		snprintf(path, sizeof(path), "%s/%s", SPRITE_SOURCE_DIR, entry->d_name);
+		if(stat(path, &input_stat) == 0 && is_newer(&input_stat, &atlas_stat)) {
+			stale = true;
+		}
+	}
+	closedir(dir);
+	if(!stale) {
+		printf("✓ sprite atlas is up to date\n");
+		return true;
+	}
+
+	printf("Packing %s into %s...\n", SPRITE_SOURCE_DIR, SPRITE_ATLAS_PREFIX);
+	fflush(stdout);
+	pid_t pid = fork();
+	if(pid == 0) {
+		execl("./atlas_packer", "./atlas_packer", SPRITE_ATLAS_PREFIX, SPRITE_SOURCE_DIR, NULL);
+		perror("Failed to start atlas packer");
+		_exit(1);
+	} else if(pid < 0) {
+		perror("Failed to fork");
+		return false;
+	}
 
-	return build_targe(&engine_config);
+	int status;
+	while(waitpid(pid, &status, 0) < 0) {
+		if(errno != EINTR) {
+			perror("waitpid");
+			return false;
+		}
+	}
+	if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		printf("✗ sprite atlas packing failed\n");
+		return false;
+	}
+	return true;
+}
+
+// Run the engine through a fixed number of frames with scripted input to
+// collect a training profile
+bool run_profile_session() {
+	printf("Running profiling session (%s frames)...\n", PGO_SESSION_FRAMES);
+	pid_t pid = fork();
+	if(pid == 0) {
+		execl("./hot_reload_engine", "./hot_reload_engine",
+			"--frames", PGO_SESSION_FRAMES, "--scripted-input", "--headless", NULL);
+		perror("Failed to start hot reload engine");
+		_exit(1);
+	} else if(pid < 0) {
+		perror("Failed to fork");
+		return false;
+	}
+
+	int status;
+	while(waitpid(pid, &status, 0) < 0) {
+		if(errno != EINTR) {
+			perror("waitpid");
+			return false;
+		}
+	}
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+#if defined(PLATFORM_MAC)
+// clang writes raw profiles that have to be merged before use
+bool merge_profile_data() {
+	BuildJob* job = &build_jobs[0];
+	memset(&job->cmd, 0, sizeof(job->cmd));
+	command_add_flags(&job->cmd, "xcrun llvm-profdata merge -o " PGO_DATA_DIR "/default.profdata");
+	DIR* dir = opendir(PGO_DATA_DIR);
+	if(dir == NULL) {
+		return false;
+	}
+	struct dirent* entry;
+	while((entry = readdir(dir)) != NULL) {
+		if(has_extension(entry->d_name, "profraw")) {
+			command_add(&job->cmd, PGO_DATA_DIR "/", entry->d_name);
+		}
+	}
+	closedir(dir);
+	return run_build_jobs(1);
+}
+#endif
+
+// Instrumented build, training run, then a rebuild with the profile. Both
+// builds share one object directory so the profile data maps onto it.
+bool build_with_pgo() {
+	static BuildProfile pgo_profile;
+	const BuildProfile* release = find_build_profile("release");
+	make_directories(PGO_DATA_DIR);
+
+	snprintf(pgo_compile_flags, sizeof(pgo_compile_flags), "%s -fprofile-generate=%s", release->compile_flags, PGO_DATA_DIR);
+	snprintf(pgo_link_flags, sizeof(pgo_link_flags), "%s -fprofile-generate=%s", release->link_flags, PGO_DATA_DIR);
+	pgo_profile = (BuildProfile){ "pgo-instrumented", pgo_compile_flags, pgo_link_flags };
+	use_build_profile(&pgo_profile);
+	snprintf(obj_root, sizeof(obj_root), "%s/pgo/obj", BUILD_DIR);
+	force_rebuild = true;
+	if(!build_all() || !pack_sprite_atlas() || !run_profile_session()) {
+		printf("PGO training run failed\n");
+		force_rebuild = false;
+		return false;
+	}
+
+#if defined(PLATFORM_MAC)
+	if(!merge_profile_data()) {
+		printf("Failed to merge profile data\n");
+		force_rebuild = false;
+		return false;
+	}
+	const char* profile_use = PGO_DATA_DIR "/default.profdata";
+#else
+	const char* profile_use = PGO_DATA_DIR;
+#endif
+
+	snprintf(pgo_compile_flags, sizeof(pgo_compile_flags), "%s -fprofile-use=%s -fprofile-correction -Wno-missing-profile",
+		release->compile_flags, profile_use);
+	snprintf(pgo_link_flags, sizeof(pgo_link_flags), "%s -fprofile-use=%s", release->link_flags, profile_use);
+	pgo_profile = (BuildProfile){ "pgo", pgo_compile_flags, pgo_link_flags };
+	use_build_profile(&pgo_profile);
+	bool ok = build_all();
+	force_rebuild = false;
+	return ok;
+}
+
+void print_usage() {
+	printf("usage: build [--profile=");
+	for(int i = 0; i < BUILD_PROFILE_COUNT; i++) {
+		printf("%s%s", i ? "|" : "", build_profiles[i].name);
+	}
+	printf("] [--pgo] [--once] [--keep-state]\n");
+	printf("  --pgo         instrumented release build, training run, then a profile guided rebuild\n");
+	printf("  --once        build and exit instead of running and watching for changes\n");
+	printf("  --keep-state  keep the game's persistent memory in %s across restarts\n", GAME_STATE_FILE);
 }
 
 void print_platform_info() {
@@ -350,51 +1553,152 @@ void print_platform_info() {
 	printf("===========================\n\n");
 }
 
-int main() {
+int main(int argc, char** argv) {
+	const BuildProfile* profile = &build_profiles[0];
+	bool use_pgo = false;
+	bool build_once = false;
+
+	for(int i = 1; i < argc; i++) {
+		if(strncmp(argv[i], "--profile=", 10) == 0) {
+			profile = find_build_profile(argv[i] + 10);
+			if(profile == NULL) {
+				printf("Unknown build profile '%s'\n", argv[i] + 10);
+				print_usage();
+				return 1;
+			}
+		} else if(strcmp(argv[i], "--pgo") == 0) {
+			use_pgo = true;
+		} else if(strcmp(argv[i], "--once") == 0) {
+			build_once = true;
+		} else if(strcmp(argv[i], "--keep-state") == 0) {
+			keep_game_state = true;
+		} else {
+			print_usage();
+			return 1;
+		}
+	}
+
 	print_platform_info();
 
-	if(!build_main_app()) {
-		printf("Failed to build main application.\n");
-		return 1;
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	worker_count = cores > 0 ? (int)cores : 1;
+
+	init_targets();
+	if(use_pgo) {
+		if(!build_with_pgo()) {
+			printf("Failed to build main application and engine modules with PGO.\n");
+			return 1;
+		}
+	} else {
+		use_build_profile(profile);
+		if(!build_all()) {
+			printf("Failed to build main application and engine modules.\n");
+			return 1;
+		}
 	}
 	main_app_built = true;
+	if(!pack_sprite_atlas()) {
+		printf("Sprites will be drawn without the atlas.\n");
+	}
 
-	if(!build_engine()){
-		printf("Failed to build engine library.\n");
+	if(build_once) {
+		return 0;
+	}
+
+	reload_timing = reload_timing_map();
+	if(reload_timing == NULL) {
+		printf("Reload timing unavailable: could not map %s\n", RELOAD_TIMING_FILE);
+	}
+
+	if(!start_source_watcher()) {
+		printf("Failed to start source watcher.\n");
 		return 1;
 	}
 
 	start_main_app();
 	
 	while(true) {
-		file_changed = 0;
-		current_file_index = 0;
+		wait_for_source_changes();
+		int64_t detected_time = reload_timing_now();
+
+		uint32_t affected = 0;
+		struct timespec edit_time = {0};
+		bool repack_sprites = sprite_image_removed;
+		sprite_image_removed = false;
+
+		for(int i = 0; i < watched_file_count; i++) {
+			WatchedFile* file = &watched_files[i];
+			if(!file->changed) {
+				continue;
+			}
+			file->changed = false;
 
-		ftw(".", display_info, 20);
+			if(is_sprite_image(file->path)) {
+				printf("\n=== Sprite changed: %s ===\n", file->path);
+				repack_sprites = true;
+				continue;
+			}
+
+			uint32_t file_targets = targets_depending_on(file->path);
+			if(file_targets == 0) {
+				continue;
+			}
 
-		if(file_changed) {
-			char *time_str = ctime(&buff.st_mtime);
+			char *time_str = ctime(&file->mtime.tv_sec);
 			time_str[strlen(time_str) - 1] = '\0';
-			printf("\n=== File changed: %s at %s ===\n", name, time_str);
-
-			if(strstr(name,"main.c") != NULL){
-				kill_game_process();
-				if(build_main_app()) {
-					build_engine();
-					start_main_app();
-				} else {
-					printf("Main app build failed, not restarting\n");
+			printf("\n=== File changed: %s at %s ===\n", file->path, time_str);
+
+			affected |= file_targets;
+			if(file->mtime.tv_sec > edit_time.tv_sec ||
+			   (file->mtime.tv_sec == edit_time.tv_sec && file->mtime.tv_nsec > edit_time.tv_nsec)) {
+				edit_time = file->mtime;
+			}
+		}
+
+		if(affected & (1u << TARGET_MAIN_APP)) {
+			kill_game_process();
+			if(build_target_mask(affected)) {
+				// Pack before starting so the new process loads the new atlas
+				if(repack_sprites || (affected & TOOL_TARGETS)) {
+					pack_sprite_atlas();
+					repack_sprites = false;
 				}
-			} else if (strstr(name, "engine.c") != NULL) {
-				printf("Engine source changed, rebuilding library for hot reload...\n");
-				if(build_engine()) {
-					printf("Engine rebuilt! Hot reload should happen automatically.\n");
-				} else {
-					printf("Main app build failed, not restarting\n");
+				start_main_app();
+			} else {
+				printf("Main app build failed, not restarting\n");
+			}
+		} else if(affected & ENGINE_MODULE_TARGETS) {
+			printf("Engine module source changed, rebuilding");
+			for(int t = 0; t < TARGET_COUNT; t++) {
+				if(affected & (1u << t)) {
+					printf(" %s", targets[t].output_name);
 				}
 			}
+			printf(" for hot reload...\n");
+			for(int i = 0; i < RELOAD_STAGE_FIRST_PLATFORM; i++) {
+				record_reload_stage(i, 0);
+			}
+			record_reload_stage(RELOAD_STAGE_EDIT, (int64_t)edit_time.tv_sec * 1000000000 + edit_time.tv_nsec);
+			record_reload_stage(RELOAD_STAGE_BUILD_DETECTED, detected_time);
+			record_reload_stage(RELOAD_STAGE_COMPILE_START, reload_timing_now());
+			bool modules_built = build_target_mask(affected & ENGINE_MODULE_TARGETS);
+			record_reload_stage(RELOAD_STAGE_LINK_DONE, reload_timing_now());
+			publish_reload_timing();
+			if(modules_built) {
+				printf("Engine modules rebuilt! Hot reload should happen automatically.\n");
+			} else {
+				printf("Engine module build failed, keeping the running build\n");
+			}
+		}
+		if(!(affected & (1u << TARGET_MAIN_APP)) && (affected & TOOL_TARGETS)) {
+			if(build_target_mask(affected & TOOL_TARGETS)) {
+				repack_sprites = true;
+			}
+		}
+		// The running renderer picks up the new atlas by itself
+		if(repack_sprites) {
+			pack_sprite_atlas();
 		}
-		usleep(10000);
 	}
 	return 0;
 }
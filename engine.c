@@ -1,65 +1,8 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <math.h>
-#include <stdbool.h>
+// Gameplay module: owns the GameState layout and its migration, and updates
+// the simulation from input. Drawing lives in the renderer module.
+#include "engine_pch.h"
+#include "EngineState.h"
 #include "GameState.h"
-// Forward declarations for OpenGL types to avoid including GLAD
-typedef unsigned int GLuint;
-typedef int GLint;
-typedef int GLsizei;
-typedef unsigned int GLenum;
-typedef float GLfloat;
-typedef unsigned char GLboolean;
-typedef void GLvoid;
-
-// SDL types we need
-typedef struct SDL_Window SDL_Window;
-typedef void* SDL_GLContext;
-typedef unsigned char Uint8;
-typedef unsigned int Uint32;
-
-// Engine state structure (must match the one in main.c)
-typedef struct {
-    void* persistent_memory;
-    size_t persistent_memory_size;
-    void* frame_memory;
-    size_t frame_memory_size;
-    SDL_Window* window;
-    SDL_GLContext gl_context;
-    unsigned int basic_shader_program;
-    float delta_time;
-    float total_time;
-    const Uint8* keyboard_state;
-    int mouse_x, mouse_y;
-    Uint32 mouse_buttons;
-    int window_width;
-    int window_height;
-    bool should_quit;
-    bool is_reloaded;
-} EngineState;
-
-// Import the OpenGL functions we need from the main executable
-extern void glGenVertexArrays(GLsizei n, GLuint *arrays);
-extern void glGenBuffers(GLsizei n, GLuint *buffers);
-extern void glBindVertexArray(GLuint array);
-extern void glBindBuffer(GLenum target, GLuint buffer);
-extern void glBufferData(GLenum target, GLsizei size, const GLvoid *data, GLenum usage);
-extern void glVertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const GLvoid *pointer);
-extern void glEnableVertexAttribArray(GLuint index);
-extern void glUseProgram(GLuint program);
-extern GLint glGetUniformLocation(GLuint program, const char *name);
-extern void glUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value);
-extern void glDrawArrays(GLenum mode, GLint first, GLsizei count);
-extern void glDeleteVertexArrays(GLsizei n, const GLuint *arrays);
-extern void glDeleteBuffers(GLsizei n, const GLuint *buffers);
-
-// OpenGL constants we need
-#define GL_ARRAY_BUFFER          0x8892
-#define GL_STATIC_DRAW           0x88E4
-#define GL_FLOAT                 0x1406
-#define GL_FALSE                 0
-#define GL_TRIANGLES             0x0004
 
 // SDL scancodes we need
 #define SDL_SCANCODE_W 26
@@ -70,119 +13,259 @@ extern void glDeleteBuffers(GLsizei n, const GLuint *buffers);
 #define SDL_SCANCODE_E 8
 #define SDL_SCANCODE_R 21
 #define SDL_SCANCODE_ESCAPE 41
+#define SDL_SCANCODE_1 30
+#define SDL_SCANCODE_5 34
 
-// Game state that persists across reloads
+// Sprite counts picked with keys 1 to 5, for load testing the renderer
+static const int sprite_count_presets[] = { 0, 1000, 10000, 100000, 200000 };
 
+static double read_game_field(const unsigned char* data, const GameStateField* field) {
+    switch (field->kind) {
+        case GAME_FIELD_BOOL:  return *(const bool*)data ? 1.0 : 0.0;
+        case GAME_FIELD_INT:   return *(const int*)data;
+        case GAME_FIELD_UINT:  return *(const unsigned int*)data;
+        case GAME_FIELD_FLOAT: return *(const float*)data;
+    }
+    return 0.0;
+}
 
-// Simple matrix operations
-typedef struct {
-    float m[16];
-} Mat4;
+static void write_game_field(unsigned char* data, const GameStateField* field, double value) {
+    switch (field->kind) {
+        case GAME_FIELD_BOOL:  *(bool*)data = value != 0.0; break;
+        case GAME_FIELD_INT:   *(int*)data = (int)value; break;
+        case GAME_FIELD_UINT:  *(unsigned int*)data = (unsigned int)value; break;
+        case GAME_FIELD_FLOAT: *(float*)data = (float)value; break;
+    }
+}
 
-static Mat4 mat4_identity() {
-    Mat4 result = {0};
-    result.m[0] = result.m[5] = result.m[10] = result.m[15] = 1.0f;
-    return result;
+static bool game_field_is_valid(const GameStateField* field, uint32_t state_size) {
+    return field->kind <= GAME_FIELD_FLOAT && field->size <= sizeof(double) &&
+           field->offset + field->size <= state_size;
 }
 
-static Mat4 mat4_translate(float x, float y, float z) {
-    Mat4 result = mat4_identity();
-    result.m[12] = x;
-    result.m[13] = y;
-    result.m[14] = z;
-    return result;
+// Bring the GameState in persistent memory in line with the layout this build
+// was compiled with. Fields are matched by name: identical fields are copied,
+// retyped numeric fields are converted and new fields get their defaults.
+static void migrate_game_state(EngineState* state) {
+    GameStateLayout* stored = game_state_layout(state->persistent_memory);
+    GameState* game = game_state(state->persistent_memory);
+    
+    GameStateLayout current;
+    game_state_describe(&current);
+    
+    if (stored->magic != GAME_STATE_LAYOUT_MAGIC || stored->field_count > GAME_STATE_MAX_FIELDS ||
+        stored->state_size > GAME_STATE_CAPACITY) {
+        // Nothing usable to migrate from; start from defaults
+        memset(game, 0, sizeof(*game));
+        game_state_set_defaults(game);
+        *stored = current;
+        return;
+    }
+    
+    if (memcmp(stored, &current, sizeof(current)) == 0) {
+        return;
+    }
+    
+    printf("GameState layout changed (%u -> %u fields, %u -> %u bytes), migrating\n",
+           stored->field_count, current.field_count, stored->state_size, current.state_size);
+    
+    // Park the old block in frame memory while the new one is rebuilt
+    ArenaMarker scratch = arena_begin_temp(&state->frame_arena);
+    unsigned char* old_data = (unsigned char*)arena_push(&state->frame_arena, stored->state_size, MEMORY_TAG_MIGRATION);
+    if (!old_data) {
+        arena_end_temp(scratch);
+        memset(game, 0, sizeof(*game));
+        game_state_set_defaults(game);
+        *stored = current;
+        return;
+    }
+    memcpy(old_data, game, stored->state_size);
+    
+    memset(game, 0, sizeof(*game));
+    game_state_set_defaults(game);
+    
+    for (uint32_t i = 0; i < current.field_count; i++) {
+        const GameStateField* field = &current.fields[i];
+        const GameStateField* old_field = NULL;
+        for (uint32_t j = 0; j < stored->field_count; j++) {
+            if (strncmp(stored->fields[j].name, field->name, sizeof(field->name)) == 0) {
+                old_field = &stored->fields[j];
+                break;
+            }
+        }
+        
+        unsigned char* new_data = (unsigned char*)game + field->offset;
+        if (!old_field || !game_field_is_valid(old_field, stored->state_size)) {
+            printf("  + %s (default)\n", field->name);
+        } else if (old_field->kind == field->kind && old_field->size == field->size) {
+            memcpy(new_data, old_data + old_field->offset, field->size);
+        } else {
+            printf("  ~ %s (converted)\n", field->name);
+            write_game_field(new_data, field, read_game_field(old_data + old_field->offset, old_field));
+        }
+    }
+    
+    for (uint32_t j = 0; j < stored->field_count; j++) {
+        bool kept = false;
+        for (uint32_t i = 0; i < current.field_count && !kept; i++) {
+            kept = strncmp(stored->fields[j].name, current.fields[i].name, sizeof(current.fields[i].name)) == 0;
+        }
+        if (!kept) {
+            printf("  - %.*s (dropped)\n", (int)sizeof(stored->fields[j].name), stored->fields[j].name);
+        }
+    }
+    
+    arena_end_temp(scratch);
+    *stored = current;
+}
+
+// Player trail: a point is dropped every TRAIL_SPACING pixels moved and
+// freed when it expires. Points come from the level's trail pool; the list
+// of live ones is a size class block that doubles and halves with the
+// count, so freed blocks get recycled by the next resize.
+#define TRAIL_SPACING 24.0f
+#define TRAIL_MIN_CAPACITY 8
+
+// Start a level: everything allocated from here on belongs to it
+static void level_begin(PersistentHeap* heap, GameLevel* level, const GameState* game) {
+    level->mark = persistent_heap_mark(heap);
+    // Normally created fresh after the mark, but a pool that outlived a
+    // rebuilt level still holds the old level's points
+    PersistentPool* trail = persistent_pool(heap, GAME_TRAIL_POOL, sizeof(TrailPoint), GAME_TRAIL_CAPACITY, MEMORY_TAG_GAMEPLAY);
+    if (trail) {
+        persistent_pool_clear(heap, trail);
+    }
+    level->trail = 0;
+    level->trail_count = 0;
+    level->trail_capacity = 0;
+    level->last_x = game->player_x;
+    level->last_y = game->player_y;
 }
 
-static Mat4 mat4_scale(float x, float y, float z) {
-    Mat4 result = mat4_identity();
-    result.m[0] = x;
-    result.m[5] = y;
-    result.m[10] = z;
-    return result;
+// Drop everything the level allocated and start it again
+static void level_restart(PersistentHeap* heap, GameLevel* level, const GameState* game) {
+    persistent_heap_release(heap, level->mark);
+    level_begin(heap, level, game);
 }
 
-static Mat4 mat4_rotate_z(float angle) {
-    Mat4 result = mat4_identity();
-    float c = cosf(angle);
-    float s = sinf(angle);
-    result.m[0] = c;
-    result.m[1] = s;
-    result.m[4] = -s;
-    result.m[5] = c;
-    return result;
+// Find the level left by the previous build, or create the first one
+static GameLevel* level_attach(PersistentHeap* heap, const GameState* game) {
+    PersistentPool* pool = persistent_pool(heap, GAME_LEVEL_POOL, sizeof(GameLevel), 1, MEMORY_TAG_GAMEPLAY);
+    if (!pool || !pool->capacity) {
+        return NULL;
+    }
+    if (pool->live_count) {
+        return PERSISTENT_PTR(heap, GameLevel, pool->elements);
+    }
+    GameLevel* level = PERSISTENT_PTR(heap, GameLevel, persistent_pool_alloc(heap, pool));
+    level_begin(heap, level, game);
+    return level;
 }
 
-static Mat4 mat4_multiply(Mat4 a, Mat4 b) {
-    Mat4 result = {0};
-    for (int i = 0; i < 4; i++) {
-        for (int j = 0; j < 4; j++) {
-            for (int k = 0; k < 4; k++) {
-                result.m[i * 4 + j] += a.m[i * 4 + k] * b.m[k * 4 + j];
-            }
+static bool trail_resize(PersistentHeap* heap, GameLevel* level, uint32_t capacity) {
+    PersistentOffset block = persistent_alloc(heap, capacity * sizeof(PersistentOffset), MEMORY_TAG_GAMEPLAY);
+    if (!block) {
+        return false;
+    }
+    if (level->trail_count) {
+        memcpy(persistent_ptr(heap, block), persistent_ptr(heap, level->trail), level->trail_count * sizeof(PersistentOffset));
+    }
+    persistent_free(heap, level->trail);
+    level->trail = block;
+    level->trail_capacity = capacity;
+    return true;
+}
+
+static void update_trail(PersistentHeap* heap, GameLevel* level, const GameState* game, float delta_time) {
+    PersistentPool* pool = persistent_pool_find(heap, GAME_TRAIL_POOL);
+    if (!pool || !pool->capacity) {
+        return;
+    }
+    
+    // Age the points and free the expired ones, keeping the rest in order
+    PersistentOffset* live = PERSISTENT_PTR(heap, PersistentOffset, level->trail);
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < level->trail_count; i++) {
+        TrailPoint* point = PERSISTENT_PTR(heap, TrailPoint, live[i]);
+        point->age += delta_time;
+        if (point->age >= GAME_TRAIL_LIFETIME) {
+            persistent_pool_free(heap, pool, live[i]);
+        } else {
+            live[kept++] = live[i];
         }
     }
-    return result;
+    level->trail_count = kept;
+    if (level->trail_capacity > TRAIL_MIN_CAPACITY && level->trail_count < level->trail_capacity / 4) {
+        trail_resize(heap, level, level->trail_capacity / 2);
+    }
+    
+    float dx = game->player_x - level->last_x;
+    float dy = game->player_y - level->last_y;
+    if (dx * dx + dy * dy < TRAIL_SPACING * TRAIL_SPACING) {
+        return;
+    }
+    if (level->trail_count == level->trail_capacity &&
+        !trail_resize(heap, level, level->trail_capacity ? level->trail_capacity * 2 : TRAIL_MIN_CAPACITY)) {
+        return;
+    }
+    PersistentOffset offset = persistent_pool_alloc(heap, pool);
+    if (!offset) {
+        // Pool exhausted; the oldest points expire soon
+        return;
+    }
+    TrailPoint* point = PERSISTENT_PTR(heap, TrailPoint, offset);
+    point->x = game->player_x;
+    point->y = game->player_y;
+    point->age = 0.0f;
+    PERSISTENT_PTR(heap, PersistentOffset, level->trail)[level->trail_count++] = offset;
+    level->last_x = game->player_x;
+    level->last_y = game->player_y;
 }
 
 void engine_init(EngineState* state) {
     printf("Engine init called\n");
     
     // Get or initialize game state from persistent memory
-    GameState* game = (GameState*)state->persistent_memory;
+    migrate_game_state(state);
+    GameState* game = game_state(state->persistent_memory);
     
-    if (!game->initialized || state->is_reloaded) {
-        if (state->is_reloaded) {
-            game->reload_count++;
-            printf("Engine reloaded %d times\n", game->reload_count);
-            printf("calling rand colors\n");
-            // Change color on reload to show it's working
-            game->color_r = (float)rand() / RAND_MAX;
-            game->color_g = (float)rand() / RAND_MAX;
-            game->color_b = (float)rand() / RAND_MAX;
-        } else {
-            // First time initialization
-            game->initialized = true;
-            game->player_x = 0.0f;
-            game->player_y = 0.0f;
-            game->player_rotation = 0.0f;
-            game->player_speed = 200.0f;
-            game->reload_count = 0;
-            game->color_r = 1.0f;
-            game->color_g = 0.5f;
-            game->color_b = 0.0f;
-        }
-        
-        // Create a triangle
-        float vertices[] = {
-            // positions         // colors
-            -0.7f, -0.5f, 0.0f,  1.0f, 0.0f, 0.0f,
-             0.5f, -0.5f, 0.0f,  0.0f, 1.0f, 0.0f,
-             0.1f,  0.5f, 0.0f,  0.0f, 0.0f, 1.0f
-        };
-        
-        // Generate vertex array and buffer
-        glGenVertexArrays(1, &game->vao);
-        glGenBuffers(1, &game->vbo);
-        
-        glBindVertexArray(game->vao);
-        
-        glBindBuffer(GL_ARRAY_BUFFER, game->vbo);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-        
-        // Position attribute
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
-        glEnableVertexAttribArray(0);
-        
-        // Color attribute
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-        glEnableVertexAttribArray(1);
-        
-        glBindVertexArray(0);
+    PersistentHeap* heap = persistent_heap(state->persistent_memory, state->persistent_memory_size);
+    if (!persistent_heap_validate(heap)) {
+        // Nothing in it can be trusted; start over with an empty heap
+        printf("Persistent heap is inconsistent, resetting it\n");
+        persistent_heap_reset(heap);
+    }
+    printf("Persistent heap: %llu of %llu bytes used, %u pools\n",
+           (unsigned long long)heap->used, (unsigned long long)heap->size, heap->pool_count);
+    
+    // The level and its trail come back from the heap by pool name. A pool
+    // whose element size changed comes back empty, and so must the trail.
+    GameLevel* level = level_attach(heap, game);
+    PersistentPool* trail = persistent_pool(heap, GAME_TRAIL_POOL, sizeof(TrailPoint), GAME_TRAIL_CAPACITY, MEMORY_TAG_GAMEPLAY);
+    if (level && (!trail || trail->live_count != level->trail_count)) {
+        printf("Trail pool was rebuilt, restarting the level\n");
+        level_restart(heap, level, game);
+    } else if (level && state->is_reloaded) {
+        printf("Trail: %u points kept across the reload\n", level->trail_count);
+    }
+    
+    if (state->is_reloaded) {
+        game->reload_count++;
+        printf("Engine reloaded %d times\n", game->reload_count);
+        printf("calling rand colors\n");
+        // Change color on reload to show it's working
+        game->color_r = (float)rand() / RAND_MAX;
+        game->color_g = (float)rand() / RAND_MAX;
+        game->color_b = (float)rand() / RAND_MAX;
+    } else if (!game->initialized) {
+        // First time initialization
+        game_state_set_defaults(game);
+        game->initialized = true;
     }
 }
 
 void engine_update(EngineState* state) {
-    GameState* game = (GameState*)state->persistent_memory;
+    GameState* game = game_state(state->persistent_memory);
     
     // Handle input
     if (state->keyboard_state[SDL_SCANCODE_W]) {
@@ -204,11 +287,27 @@ void engine_update(EngineState* state) {
         game->player_rotation -= 2.0f * state->delta_time;
     }
     
-    // Reset position with R
+    // Reset position and the level with R
+    PersistentHeap* heap = persistent_heap_find(state->persistent_memory);
+    GameLevel* level = game_level(heap);
     if (state->keyboard_state[SDL_SCANCODE_R]) {
         game->player_x = 0.0f;
         game->player_y = 0.0f;
         game->player_rotation = 0.0f;
+        if (level) {
+            level_restart(heap, level, game);
+        }
+    }
+    if (level) {
+        update_trail(heap, level, game, state->delta_time);
+    }
+    
+    // Number keys pick the size of the renderer's sprite swarm
+    for (int key = SDL_SCANCODE_1; key <= SDL_SCANCODE_5; key++) {
+        if (state->keyboard_state[key] && game->sprite_count != sprite_count_presets[key - SDL_SCANCODE_1]) {
+            game->sprite_count = sprite_count_presets[key - SDL_SCANCODE_1];
+            printf("Sprite swarm: %d sprites\n", game->sprite_count);
+        }
     }
     
     // Quit with ESC
@@ -217,49 +316,7 @@ void engine_update(EngineState* state) {
     }
 }
 
-void engine_render(EngineState* state) {
-    GameState* game = (GameState*)state->persistent_memory;
-    
-    // Use the shader program compiled in main.c
-    glUseProgram(state->basic_shader_program);
-    
-    // Calculate aspect ratio
-    float aspect = (float)state->window_width / state->window_height;
-    
-    // Create transformation matrix
-    Mat4 scale = mat4_scale(0.5f / aspect, 0.5f, 1.0f);
-    Mat4 rotate = mat4_rotate_z(game->player_rotation);
-    Mat4 translate = mat4_translate(game->player_x / 400.0f, game->player_y / 300.0f, 0.0f);
-    
-    Mat4 transform = mat4_multiply(translate, mat4_multiply(rotate, scale));
-    
-    // Set transform uniform
-    int transform_loc = glGetUniformLocation(state->basic_shader_program, "transform");
-    glUniformMatrix4fv(transform_loc, 1, GL_FALSE, transform.m);
-    
-    glBindVertexArray(game->vao);
-    glDrawArrays(GL_TRIANGLES, 0, 3);
-    glBindVertexArray(0);
-    
-    // Draw some text info (would need text rendering in real app)
-    if (state->is_reloaded) {
-        printf("Reloaded! Position: (%.2f, %.2f), Rotation: %.2f, Reloads: %d\n", 
-               game->player_x, game->player_y, game->player_rotation, game->reload_count);
-    }
-}
-
 void engine_cleanup(EngineState* state) {
+    (void)state;
     printf("Engine cleanup called\n");
-    
-    GameState* game = (GameState*)state->persistent_memory;
-    
-    // Clean up OpenGL resources
-    if (game->vao) {
-        glDeleteVertexArrays(1, &game->vao);
-        game->vao = 0;
-    }
-    if (game->vbo) {
-        glDeleteBuffers(1, &game->vbo);
-        game->vbo = 0;
-    }
 }
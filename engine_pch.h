@@ -0,0 +1,19 @@
+#ifndef ENGINE_PCH_H
+#define ENGINE_PCH_H
+// Umbrella header precompiled once by build.c and force-included into every
+// engine translation unit. Keep it to headers that rarely change: an edit
+// here rebuilds the PCH and then every engine object. Large third party
+// headers (glad, SDL) belong here once the engine includes them; headers we
+// edit while iterating, like GameState.h, stay in the sources.
+// Included first, so it also picks the libc feature level: the allocators
+// need mmap flags and madvise, which strict C99 hides.
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "hash.h"
+#endif
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -8,12 +9,26 @@
 #include <signal.h>
 #include <execinfo.h>
 #include <time.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/mman.h>
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#include <poll.h>
+#endif
 
 #include <SDL3/SDL.h>
 #include <glad.h>
 
 #include "platform.h"
-#include "GameState.h"
+#include "ReloadTiming.h"
+#include "hash.h"
+#include "EngineState.h"
+#include "MemoryMap.h"
+#include "VirtualMemory.h"
+#include "snapshot.h"
 
 // Signal handler for debugging
 void signal_handler(int sig) {
@@ -29,55 +44,52 @@ void signal_handler(int sig) {
     exit(1);
 }
 
-// Engine interface structure - shared between main and engine
 typedef struct {
-    // Persistent memory block that survives reloads
-    void* persistent_memory;
-    size_t persistent_memory_size;
-    
-    // Frame memory that gets cleared each frame
-    void* frame_memory;
-    size_t frame_memory_size;
-    
-    // Platform services that engine can use
-    SDL_Window* window;
-    SDL_GLContext gl_context;
-    
-    // Shader programs compiled by main.c
-    unsigned int basic_shader_program;
-    
-    // Timing info
-    float delta_time;
-    float total_time;
-    
-    // Input state
-    const bool* keyboard_state;
-    float mouse_x, mouse_y;
-    Uint32 mouse_buttons;
-    
-    // Window dimensions
-    int window_width;
-    int window_height;
-    
-    // Control flags
-    bool should_quit;
-    bool is_reloaded;
-} EngineState;
+    void* handle;
+    module_init_func init;
+    module_update_func update;
+    module_render_func render;
+    module_cleanup_func cleanup;
+    char staged_path[256];
+    uint64_t content_hash;
+} EngineLibrary;
+
+// Engine modules are separate shared libraries that are built, watched and
+// reloaded on their own. Each phase runs over the table in order, so the
+// module that migrates GameState on init comes first.
+typedef struct {
+    const char* name;
+    char lib_path[64];
+    char stem[64];
+    EngineLibrary live;
+    // The previous generation stays loaded so F9 can revert to it
+    EngineLibrary fallback;
+} EngineModule;
 
-// Engine function pointers
-typedef void (*engine_init_func)(EngineState* state);
-typedef void (*engine_update_func)(EngineState* state);
-typedef void (*engine_render_func)(EngineState* state);
-typedef void (*engine_cleanup_func)(EngineState* state);
+static EngineModule engine_modules[] = {
+    { .name = "engine" },
+    { .name = "renderer" },
+};
+#define ENGINE_MODULE_COUNT (int)(sizeof(engine_modules) / sizeof(engine_modules[0]))
 
+// Module libraries that changed together. Bit i of mask is set when
+// engine_modules[i] was rebuilt; notify_time is when the first one was seen.
 typedef struct {
-    void* handle;
-    engine_init_func init;
-    engine_update_func update;
-    engine_render_func render;
-    engine_cleanup_func cleanup;
-    time_t last_write_time;
-} EngineLibrary;
+    uint32_t mask;
+    int64_t notify_time;
+} LibraryChanges;
+
+// Background watcher that flags the main loop when module libraries change.
+// `pending` points at `slot` while a batch waits for the main loop. The
+// watcher only writes the slot while nothing is pending and the main loop
+// only clears `pending` once it has copied the slot, so the mask and time
+// are always read as the pair the watcher published.
+typedef struct {
+    SDL_Thread* thread;
+    LibraryChanges slot;
+    void* pending;
+    SDL_AtomicInt running;
+} LibraryWatcher;
 
 // Shader compilation helper
 static unsigned int compile_shader(const char* vertex_src, const char* fragment_src) {
@@ -123,6 +135,95 @@ static unsigned int compile_shader(const char* vertex_src, const char* fragment_
     return program;
 }
 
+// Libraries built together land within a few milliseconds of each other;
+// wait this long after the last one so they are reloaded as one batch
+#define LIBRARY_SETTLE_MS 20
+
+static int find_engine_module(const char* lib_name) {
+    for (int i = 0; i < ENGINE_MODULE_COUNT; i++) {
+        if (strcmp(engine_modules[i].lib_path, lib_name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Watcher side: hand `changes` over, or return false if the main loop hasn't
+// taken the previous batch yet, in which case the caller keeps accumulating
+// and tries again
+static bool publish_library_changes(LibraryWatcher* watcher, const LibraryChanges* changes) {
+    if (SDL_GetAtomicPointer(&watcher->pending)) {
+        return false;
+    }
+    watcher->slot = *changes;
+    SDL_SetAtomicPointer(&watcher->pending, &watcher->slot);
+    return true;
+}
+
+// Main loop side: copy out the waiting batch, if any, and free the slot
+static bool take_library_changes(LibraryWatcher* watcher, LibraryChanges* changes) {
+    const LibraryChanges* pending = (const LibraryChanges*)SDL_GetAtomicPointer(&watcher->pending);
+    if (!pending) {
+        return false;
+    }
+    *changes = *pending;
+    SDL_SetAtomicPointer(&watcher->pending, NULL);
+    return true;
+}
+
+#if defined(PLATFORM_LINUX)
+// Watch the directory rather than the files themselves: the linker replaces
+// the library, which would drop a watch held on the old inode.
+static int library_watcher_thread(void* data) {
+    LibraryWatcher* watcher = (LibraryWatcher*)data;
+    
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0) {
+        perror("inotify_init1");
+        return 1;
+    }
+    if (inotify_add_watch(fd, ".", IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        perror("inotify_add_watch");
+        close(fd);
+        return 1;
+    }
+    
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    LibraryChanges changes = {0};
+    
+    while (SDL_GetAtomicInt(&watcher->running)) {
+        // Wake up periodically so shutdown never blocks on a quiet directory
+        int ready = poll(&pfd, 1, changes.mask ? LIBRARY_SETTLE_MS : 250);
+        if (ready == 0 && changes.mask && publish_library_changes(watcher, &changes)) {
+            changes.mask = 0;
+        }
+        if (ready <= 0) {
+            continue;
+        }
+        
+        ssize_t len = read(fd, buffer, sizeof(buffer));
+        if (len <= 0) {
+            continue;
+        }
+        
+        for (char* ptr = buffer; ptr < buffer + len; ) {
+            struct inotify_event* event = (struct inotify_event*)ptr;
+            int module = event->len > 0 ? find_engine_module(event->name) : -1;
+            if (module >= 0) {
+                if (!changes.mask) {
+                    changes.notify_time = reload_timing_now();
+                }
+                changes.mask |= 1u << module;
+            }
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    
+    close(fd);
+    return 0;
+}
+#else
 // Get last write time of library file
 static time_t get_library_write_time(const char* filename) {
     struct stat file_stat;
@@ -132,65 +233,535 @@ static time_t get_library_write_time(const char* filename) {
     return 0;
 }
 
-// Load engine library
-static bool load_engine_library(EngineLibrary* lib, const char* lib_path, const char* temp_path) {
-    printf("DEBUG: load_engine_library called with lib_path=%s, temp_path=%s\n", lib_path, temp_path);
+// No inotify here, so poll the write times off the main thread instead
+static int library_watcher_thread(void* data) {
+    LibraryWatcher* watcher = (LibraryWatcher*)data;
+    time_t last_write_time[ENGINE_MODULE_COUNT];
+    for (int i = 0; i < ENGINE_MODULE_COUNT; i++) {
+        last_write_time[i] = get_library_write_time(engine_modules[i].lib_path);
+    }
+    
+    LibraryChanges changes = {0};
+    while (SDL_GetAtomicInt(&watcher->running)) {
+        SDL_Delay(100);
+        for (int i = 0; i < ENGINE_MODULE_COUNT; i++) {
+            time_t write_time = get_library_write_time(engine_modules[i].lib_path);
+            if (write_time != 0 && write_time != last_write_time[i]) {
+                last_write_time[i] = write_time;
+                if (!changes.mask) {
+                    changes.notify_time = reload_timing_now();
+                }
+                changes.mask |= 1u << i;
+            }
+        }
+        if (changes.mask && publish_library_changes(watcher, &changes)) {
+            changes.mask = 0;
+        }
+    }
+    return 0;
+}
+#endif
+
+static bool start_library_watcher(LibraryWatcher* watcher) {
+    SDL_SetAtomicPointer(&watcher->pending, NULL);
+    SDL_SetAtomicInt(&watcher->running, 1);
+    watcher->thread = SDL_CreateThread(library_watcher_thread, "library_watcher", watcher);
+    if (!watcher->thread) {
+        printf("Failed to start library watcher: %s\n", SDL_GetError());
+        return false;
+    }
+    return true;
+}
+
+static void stop_library_watcher(LibraryWatcher* watcher) {
+    if (watcher->thread) {
+        SDL_SetAtomicInt(&watcher->running, 0);
+        SDL_WaitThread(watcher->thread, NULL);
+        watcher->thread = NULL;
+    }
+}
+
+// Staged copies are named <stem>_<pid>_<generation><ext> so dlopen never
+// hands back a cached image of an older build
+#define STAGED_LIBRARY_DIR "./"
+static unsigned int library_generation = 0;
+
+// Per-reload stage timestamps; build stages are pulled from the shared block
+static ReloadTimingShared* shared_reload_timing = NULL;
+static uint32_t last_build_sequence = 0;
+static int64_t reload_stamps[RELOAD_STAGE_COUNT];
+static bool reload_in_flight = false;
+
+#define RELOAD_HISTORY_SIZE 32
+static double reload_history_ms[RELOAD_HISTORY_SIZE];
+static int reload_history_count = 0;
+
+// Copy the library without spawning a process; copy_file_range keeps the
+// data in the kernel and falls back to read/write where it isn't supported
+static bool copy_library_file(const char* src_path, const char* dst_path) {
+    int src = open(src_path, O_RDONLY | O_CLOEXEC);
+    if (src < 0) {
+        printf("ERROR: Failed to open %s: %s\n", src_path, strerror(errno));
+        return false;
+    }
     
-    // Copy library to temp location to avoid locking issues
-    char copy_cmd[512];
-    snprintf(copy_cmd, sizeof(copy_cmd), "cp %s %s", lib_path, temp_path);
-    printf("DEBUG: Copying library with command: %s\n", copy_cmd);
-    int ret = system(copy_cmd);
-    if (ret != 0) {
-        printf("ERROR: Failed to copy library, return code: %d\n", ret);
+    struct stat src_stat;
+    if (fstat(src, &src_stat) != 0) {
+        printf("ERROR: Failed to stat %s: %s\n", src_path, strerror(errno));
+        close(src);
         return false;
     }
     
+    int dst = open(dst_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0755);
+    if (dst < 0) {
+        printf("ERROR: Failed to create %s: %s\n", dst_path, strerror(errno));
+        close(src);
+        return false;
+    }
+    
+    off_t remaining = src_stat.st_size;
+    bool ok = true;
+    
+#if defined(PLATFORM_LINUX)
+    while (remaining > 0) {
+        ssize_t copied = copy_file_range(src, NULL, dst, NULL, (size_t)remaining, 0);
+        if (copied <= 0) {
+            break;
+        }
+        remaining -= copied;
+    }
+#endif
+    
+    char buffer[64 * 1024];
+    while (remaining > 0) {
+        ssize_t bytes_read = read(src, buffer, sizeof(buffer));
+        if (bytes_read <= 0) {
+            ok = false;
+            break;
+        }
+        if (write(dst, buffer, (size_t)bytes_read) != bytes_read) {
+            ok = false;
+            break;
+        }
+        remaining -= bytes_read;
+    }
+    
+    if (!ok) {
+        printf("ERROR: Failed to copy %s to %s: %s\n", src_path, dst_path, strerror(errno));
+    }
+    
+    close(src);
+    close(dst);
+    return ok;
+}
+
+// Hash the library's bytes so a rebuild that produced an identical binary
+// doesn't cost a reload. Returns 0 if the file can't be read.
+static uint64_t hash_library_file(const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    
+    uint64_t hash = 0;
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0) {
+        void* data = mmap(NULL, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            hash = hash_bytes(data, (size_t)file_stat.st_size, HASH_SEED);
+            munmap(data, (size_t)file_stat.st_size);
+        }
+    }
+    close(fd);
+    return hash;
+}
+
+// Remove staged copies left behind by sessions that didn't shut down cleanly.
+// Copies whose pid is still running belong to another instance, such as a
+// headless benchmark next to the game, and are left alone.
+static void remove_stale_staged_libraries(const char* stem) {
+    DIR* dir = opendir(STAGED_LIBRARY_DIR);
+    if (!dir) {
+        return;
+    }
+    
+    char prefix[64];
+    snprintf(prefix, sizeof(prefix), "%s_", stem);
+    size_t prefix_len = strlen(prefix);
+    
+    int removed = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char* name = entry->d_name;
+        const char* ext = strrchr(name, '.');
+        if (strncmp(name, prefix, prefix_len) != 0 || name[prefix_len] < '0' || name[prefix_len] > '9' ||
+            !ext || strcmp(ext, DYLIB_EXTENSION) != 0) {
+            continue;
+        }
+        char* end;
+        long pid = strtol(name + prefix_len, &end, 10);
+        if (*end != '_' || pid <= 0 || pid == (long)getpid() || kill((pid_t)pid, 0) == 0 || errno == EPERM) {
+            continue;
+        }
+        char path[512];
+        snprintf(path, sizeof(path), "%s%s", STAGED_LIBRARY_DIR, name);
+        if (unlink(path) == 0) {
+            removed++;
+        }
+    }
+    closedir(dir);
+    if (removed > 0) {
+        printf("Removed %d stale staged cop%s of %s\n", removed, removed == 1 ? "y" : "ies", stem);
+    }
+}
+
+// Look up <module>_<phase> in a loaded module library
+static void* load_module_symbol(void* handle, const char* module, const char* phase) {
+    char symbol[128];
+    snprintf(symbol, sizeof(symbol), "%s_%s", module, phase);
+    void* address = dlsym(handle, symbol);
+    printf("DEBUG: %s = %p\n", symbol, address);
+    return address;
+}
+
+// Load a module's library
+static bool load_engine_library(EngineLibrary* lib, const EngineModule* module) {
+    snprintf(lib->staged_path, sizeof(lib->staged_path), STAGED_LIBRARY_DIR "%s_%d_%u" DYLIB_EXTENSION,
+             module->stem, (int)getpid(), library_generation++);
+    printf("DEBUG: load_engine_library called with lib_path=%s, staged_path=%s\n", module->lib_path, lib->staged_path);
+    
+    lib->content_hash = hash_library_file(module->lib_path);
+    
+    // Stage a private copy so the build can overwrite the original while it is loaded
+    if (!copy_library_file(module->lib_path, lib->staged_path)) {
+        unlink(lib->staged_path);
+        lib->staged_path[0] = '\0';
+        return false;
+    }
+    reload_stamps[RELOAD_STAGE_LIBRARY_STAGED] = reload_timing_now();
+    
     // Load the library
-    printf("DEBUG: About to dlopen %s\n", temp_path);
-    lib->handle = dlopen(temp_path, RTLD_NOW);
+    printf("DEBUG: About to dlopen %s\n", lib->staged_path);
+    lib->handle = dlopen(lib->staged_path, RTLD_NOW);
     if (!lib->handle) {
-        printf("Failed to load engine library: %s\n", dlerror());
+        printf("Failed to load %s library: %s\n", module->name, dlerror());
+        unlink(lib->staged_path);
+        lib->staged_path[0] = '\0';
         return false;
     }
     printf("DEBUG: dlopen successful, handle=%p\n", lib->handle);
     
-    // Get function pointers
+    // Get function pointers; update and render are optional per module
     printf("DEBUG: Getting function pointers...\n");
-    lib->init = (engine_init_func)dlsym(lib->handle, "engine_init");
-    printf("DEBUG: engine_init = %p\n", lib->init);
-    
-    lib->update = (engine_update_func)dlsym(lib->handle, "engine_update");
-    printf("DEBUG: engine_update = %p\n", lib->update);
+    lib->init = (module_init_func)load_module_symbol(lib->handle, module->name, "init");
+    lib->update = (module_update_func)load_module_symbol(lib->handle, module->name, "update");
+    lib->render = (module_render_func)load_module_symbol(lib->handle, module->name, "render");
+    lib->cleanup = (module_cleanup_func)load_module_symbol(lib->handle, module->name, "cleanup");
     
-    lib->render = (engine_render_func)dlsym(lib->handle, "engine_render");
-    printf("DEBUG: engine_render = %p\n", lib->render);
-    
-    lib->cleanup = (engine_cleanup_func)dlsym(lib->handle, "engine_cleanup");
-    printf("DEBUG: engine_cleanup = %p\n", lib->cleanup);
-    
-    if (!lib->init || !lib->update || !lib->render || !lib->cleanup) {
-        printf("Failed to load engine functions\n");
+    if (!lib->init || !lib->cleanup) {
+        printf("Failed to load %s functions\n", module->name);
         printf("  init: %p\n", lib->init);
-        printf("  update: %p\n", lib->update);
-        printf("  render: %p\n", lib->render);
         printf("  cleanup: %p\n", lib->cleanup);
         dlclose(lib->handle);
         lib->handle = NULL;
+        unlink(lib->staged_path);
+        lib->staged_path[0] = '\0';
         return false;
     }
     
-    lib->last_write_time = get_library_write_time(lib_path);
+    reload_stamps[RELOAD_STAGE_LIBRARY_LOADED] = reload_timing_now();
     printf("DEBUG: Library loaded successfully\n");
     return true;
 }
 
-// Unload engine library
+// Unload a module library
 static void unload_engine_library(EngineLibrary* lib) {
     if (lib->handle) {
         dlclose(lib->handle);
         lib->handle = NULL;
     }
+    // Drop this generation's staged copy along with it
+    if (lib->staged_path[0]) {
+        unlink(lib->staged_path);
+        lib->staged_path[0] = '\0';
+    }
+}
+
+// Make `next` the live library between frames. The outgoing library is left
+// loaded in `next` so it can serve as a fallback.
+static void swap_engine_library(EngineLibrary* live, EngineLibrary* next, EngineState* state) {
+    if (live->cleanup) {
+        live->cleanup(state);
+    }
+    
+    EngineLibrary previous = *live;
+    *live = *next;
+    *next = previous;
+    
+    state->is_reloaded = true;
+    live->init(state);
+}
+
+// Reload the modules whose bit is set in `mask`. Every new build is loaded
+// before any is swapped in, so modules rebuilt together (say, after a shared
+// header changed) go live on the same frame. Returns the modules swapped.
+static uint32_t reload_engine_modules(uint32_t mask, EngineState* state) {
+    EngineLibrary candidates[ENGINE_MODULE_COUNT];
+    memset(candidates, 0, sizeof(candidates));
+    uint32_t loaded = 0;
+    
+    for (int i = 0; i < ENGINE_MODULE_COUNT; i++) {
+        EngineModule* module = &engine_modules[i];
+        if (!(mask & (1u << i))) {
+            continue;
+        }
+        uint64_t new_hash = hash_library_file(module->lib_path);
+        if (new_hash != 0 && new_hash == module->live.content_hash) {
+            printf("%s unchanged, skipping reload\n", module->lib_path);
+        } else if (load_engine_library(&candidates[i], module)) {
+            loaded |= 1u << i;
+        } else {
+            printf("Failed to reload %s, keeping the current build\n", module->lib_path);
+        }
+    }
+    
+    for (int i = 0; i < ENGINE_MODULE_COUNT; i++) {
+        EngineModule* module = &engine_modules[i];
+        if (loaded & (1u << i)) {
+            // Retire the oldest generation; the current one becomes the fallback
+            unload_engine_library(&module->fallback);
+            module->fallback = candidates[i];
+            swap_engine_library(&module->live, &module->fallback, state);
+            printf("Reloaded %s\n", module->lib_path);
+        }
+    }
+    return loaded;
+}
+
+static void begin_reload_timing(int64_t notify_time) {
+    for (int i = 0; i < RELOAD_STAGE_COUNT; i++) {
+        reload_stamps[i] = 0;
+    }
+    reload_stamps[RELOAD_STAGE_LIBRARY_NOTIFIED] = notify_time;
+    reload_stamps[RELOAD_STAGE_RELOAD_START] = reload_timing_now();
+    reload_in_flight = true;
+}
+
+static void print_reload_histogram(void) {
+    // Power of two millisecond buckets: <1, <2, <4 ... <2048, >=2048
+    enum { BUCKET_COUNT = 13 };
+    int buckets[BUCKET_COUNT] = {0};
+    int count = reload_history_count < RELOAD_HISTORY_SIZE ? reload_history_count : RELOAD_HISTORY_SIZE;
+    
+    for (int i = 0; i < count; i++) {
+        int bucket = 0;
+        double limit = 1.0;
+        while (bucket < BUCKET_COUNT - 1 && reload_history_ms[i] >= limit) {
+            bucket++;
+            limit *= 2.0;
+        }
+        buckets[bucket]++;
+    }
+    
+    int first = 0, last = BUCKET_COUNT - 1;
+    while (first < last && buckets[first] == 0) first++;
+    while (last > first && buckets[last] == 0) last--;
+    
+    printf("Reload latency histogram (last %d reloads):\n", count);
+    for (int bucket = first; bucket <= last; bucket++) {
+        if (bucket == BUCKET_COUNT - 1) {
+            printf("  >= %5d ms | ", 1 << (bucket - 1));
+        } else {
+            printf("  <  %5d ms | ", 1 << bucket);
+        }
+        for (int i = 0; i < buckets[bucket]; i++) {
+            putchar('#');
+        }
+        printf(" %d\n", buckets[bucket]);
+    }
+}
+
+// Print the stage breakdown for the reload that just finished its first frame
+static void finish_reload_timing(void) {
+    reload_stamps[RELOAD_STAGE_FIRST_FRAME] = reload_timing_now();
+    reload_in_flight = false;
+    
+    // Only trust build stamps published since the last report
+    if (shared_reload_timing && shared_reload_timing->sequence != last_build_sequence) {
+        last_build_sequence = shared_reload_timing->sequence;
+        for (int i = 0; i < RELOAD_STAGE_FIRST_PLATFORM; i++) {
+            reload_stamps[i] = shared_reload_timing->stamps[i];
+        }
+    }
+    
+    printf("=== Reload timing ===\n");
+    int first = -1, previous = -1;
+    for (int stage = 0; stage < RELOAD_STAGE_COUNT; stage++) {
+        if (reload_stamps[stage] == 0) {
+            continue;
+        }
+        if (previous >= 0) {
+            printf("  %-20s -> %-20s : %9.2f ms\n", reload_stage_name(previous), reload_stage_name(stage),
+                   (reload_stamps[stage] - reload_stamps[previous]) / 1e6);
+        } else {
+            first = stage;
+        }
+        previous = stage;
+    }
+    
+    double total_ms = (reload_stamps[RELOAD_STAGE_FIRST_FRAME] - reload_stamps[first]) / 1e6;
+    printf("  total (%s -> %s) : %.2f ms\n", reload_stage_name(first),
+           reload_stage_name(RELOAD_STAGE_FIRST_FRAME), total_ms);
+    
+    reload_history_ms[reload_history_count % RELOAD_HISTORY_SIZE] = total_ms;
+    reload_history_count++;
+    print_reload_histogram();
+}
+
+// Persistent memory is mapped at the same virtual address in every run, so
+// pointers stored in it stay valid across restarts as well as reloads. The
+// base is far above where the loader and heap place things on 64-bit
+// systems and is 2MB aligned for huge pages.
+#define PERSISTENT_MEMORY_BASE ((uintptr_t)0x200000000000ull)
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+// Never committed, so running off the end of the block faults. A whole huge
+// page, as hugetlb mappings can't be split any finer.
+#define PERSISTENT_GUARD_SIZE HUGE_PAGE_SIZE
+
+#if defined(PLATFORM_LINUX) && !defined(MAP_FIXED_NOREPLACE)
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+// Reserve `size` bytes of zeroed persistent memory plus the guard, all
+// inaccessible until committed (see commit_persistent_memory). With
+// `use_hugetlb` committed pages come from the reserved hugetlbfs pool
+// (vm.nr_hugepages), and touching one when the pool is empty raises SIGBUS;
+// otherwise transparent huge pages are requested. Falls back to an address
+// of the kernel's choosing if the fixed one is taken.
+static void* map_persistent_memory(size_t size, bool use_hugetlb) {
+    void* address = (void*)PERSISTENT_MEMORY_BASE;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+    size_t reserve_size = size + PERSISTENT_GUARD_SIZE;
+    
+#if defined(PLATFORM_LINUX)
+    flags |= MAP_FIXED_NOREPLACE;
+    if (use_hugetlb) {
+        void* memory = mmap(address, reserve_size, PROT_NONE, flags | MAP_HUGETLB, -1, 0);
+        if (memory != MAP_FAILED) {
+            printf("Persistent memory: %zu MB of hugetlb pages reserved at %p\n", size >> 20, memory);
+            return memory;
+        }
+        printf("hugetlb mapping failed (%s), using transparent huge pages\n", strerror(errno));
+    }
+#else
+    (void)use_hugetlb;
+#endif
+    
+    void* memory = mmap(address, reserve_size, PROT_NONE, flags, -1, 0);
+    if (memory == MAP_FAILED) {
+        printf("Could not map persistent memory at %p (%s), using any address\n", address, strerror(errno));
+        memory = mmap(NULL, reserve_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (memory == MAP_FAILED) {
+            return NULL;
+        }
+    } else if (memory != address) {
+        // Kernels before 4.17 treat the address as a hint
+        printf("Persistent memory landed at %p instead of %p\n", memory, address);
+    }
+    
+#if defined(PLATFORM_LINUX)
+    if (madvise(memory, size, MADV_HUGEPAGE) != 0) {
+        printf("MADV_HUGEPAGE failed: %s\n", strerror(errno));
+    }
+#endif
+    printf("Persistent memory: %zu MB reserved at %p\n", size >> 20, memory);
+    return memory;
+}
+
+// Map persistent memory from `path` so it outlives the process: a restarted
+// build remaps the same bytes at the same address and carries on. The file
+// is created and sized on first use.
+static bool persistent_memory_is_file = false;
+#define PERSISTENT_FLUSH_INTERVAL 5.0f
+
+static void* map_persistent_state_file(const char* path, size_t size) {
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        printf("Failed to open state file %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    
+    struct stat file_stat;
+    bool restored = fstat(fd, &file_stat) == 0 && (size_t)file_stat.st_size == size;
+    if (!restored && ftruncate(fd, (off_t)size) != 0) {
+        printf("Failed to size state file %s: %s\n", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    
+    // The guard past the end of the file is never committed, so it is never
+    // touched and the mapping can safely run beyond the file
+    void* address = (void*)PERSISTENT_MEMORY_BASE;
+    int flags = MAP_SHARED | MAP_NORESERVE;
+#if defined(PLATFORM_LINUX)
+    flags |= MAP_FIXED_NOREPLACE;
+#endif
+    void* memory = mmap(address, size + PERSISTENT_GUARD_SIZE, PROT_NONE, flags, fd, 0);
+    if (memory == MAP_FAILED) {
+        printf("Could not map %s at %p (%s), pointers stored in it will not survive\n", path, address, strerror(errno));
+        memory = mmap(NULL, size + PERSISTENT_GUARD_SIZE, PROT_NONE, MAP_SHARED | MAP_NORESERVE, fd, 0);
+    }
+    close(fd);
+    if (memory == MAP_FAILED) {
+        printf("Failed to map state file %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    
+    persistent_memory_is_file = true;
+    printf("Persistent memory: %zu MB at %p, %s %s\n", size >> 20, memory,
+           restored ? "restored from" : "backed by new", path);
+    return memory;
+}
+
+// Commit the fixed regions and the heap header, then whatever the heap had
+// committed if the memory came back from a state file
+static bool commit_persistent_memory(void* memory) {
+    if (!vm_commit(memory, PERSISTENT_MEMORY_INITIAL_COMMIT)) {
+        return false;
+    }
+    return vm_commit(memory, persistent_memory_committed(memory));
+}
+
+// Write file-backed persistent memory back at a point where it is
+// consistent, i.e. between frames. `wait` blocks until it reaches the disk.
+// Only the committed part can have changed.
+static void flush_persistent_memory(void* memory, bool wait) {
+    size_t size = persistent_memory_committed(memory);
+    if (persistent_memory_is_file && msync(memory, size, wait ? MS_SYNC : MS_ASYNC) != 0) {
+        printf("msync failed: %s\n", strerror(errno));
+    }
+}
+
+// While snapshots track persistent memory, tracked pages have to stay
+// committed and write-protected: a heap that decommitted one and committed
+// it again would leave it writable without the fault that saves it. Stop
+// the heap from decommitting, and make it count every tracked page as
+// committed again after a rewind or reset handed it an older header.
+// `tracked` is 0 when snapshots are off.
+static void sync_heap_with_snapshots(void* memory, size_t tracked) {
+    PersistentHeap* heap = persistent_heap_find(memory);
+    if (!heap) {
+        return;
+    }
+    // Only written when it changes, since every write to tracked memory
+    // costs a saved page
+    uint32_t keep_committed = tracked != 0;
+    if (heap->keep_committed != keep_committed) {
+        heap->keep_committed = keep_committed;
+    }
+    if (PERSISTENT_HEAP_OFFSET + heap->committed < tracked) {
+        heap->committed = tracked - PERSISTENT_HEAP_OFFSET;
+    }
 }
 
 // Basic shader sources
@@ -213,20 +784,305 @@ static const char* basic_fragment_shader =
     "    FragColor = vec4(vertexColor, 1.0);\n"
     "}\n";
 
-int main(int argc, char* argv[]) {
-    // Install signal handlers for debugging
-    signal(SIGSEGV, signal_handler);
-    signal(SIGABRT, signal_handler);
+// Keys held in turn by --scripted-input, so unattended runs (such as PGO
+// training sessions) exercise the engine's input paths
+static const SDL_Scancode scripted_input_keys[] = {
+    SDL_SCANCODE_W, SDL_SCANCODE_D, SDL_SCANCODE_Q, SDL_SCANCODE_S, SDL_SCANCODE_A, SDL_SCANCODE_E
+};
+#define SCRIPTED_INPUT_FRAMES_PER_KEY 30
+
+static void update_scripted_input(bool* keys, Uint64 frame) {
+    const int key_count = sizeof(scripted_input_keys) / sizeof(scripted_input_keys[0]);
+    for (int i = 0; i < key_count; i++) {
+        keys[scripted_input_keys[i]] = false;
+    }
+    keys[scripted_input_keys[(frame / SCRIPTED_INPUT_FRAMES_PER_KEY) % key_count]] = true;
+}
+
+// Frame memory is committed in steps of this much as the arena grows
+#define FRAME_COMMIT_GRANULARITY (256 * 1024)
+
+// Rewind history is capped at this many saved 4KB pages (16MB)
+#define REWIND_MAX_PAGES 4096
+#define REWIND_STEP_FRAMES 60
+
+// Render commands recorded per frame; more are dropped with a warning
+#define RENDER_COMMAND_CAPACITY 16384
+
+static void set_render_state(uint32_t state, uint32_t* current) {
+    uint32_t changed = state ^ *current;
+    if (changed & RENDER_STATE_DEPTH_TEST) {
+        if (state & RENDER_STATE_DEPTH_TEST) {
+            glEnable(GL_DEPTH_TEST);
+        } else {
+            glDisable(GL_DEPTH_TEST);
+        }
+    }
+    if (changed & RENDER_STATE_ALPHA_BLEND) {
+        if (state & RENDER_STATE_ALPHA_BLEND) {
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        } else {
+            glDisable(GL_BLEND);
+        }
+    }
+    *current = state;
+}
+
+// Tally the state changes executing `order` would make, without GL. Starts
+// from the same assumptions as execute_render_commands.
+static void count_render_commands(const RenderCommandBuffer* buffer, const uint32_t* order, RenderCommandStats* stats) {
+    uint32_t program = UINT32_MAX;
+    uint32_t texture = UINT32_MAX;
+    uint32_t vertex_array = UINT32_MAX;
+    uint32_t state = 0;
+    for (uint32_t i = 0; i < buffer->count; i++) {
+        const RenderCommand* command = &buffer->commands[order[i]];
+        if (command->type != RENDER_COMMAND_DRAW) {
+            continue;
+        }
+        if (command->state != state) {
+            state = command->state;
+            stats->state_changes++;
+        }
+        if (command->draw.program != program) {
+            program = command->draw.program;
+            stats->program_changes++;
+        }
+        if (command->draw.texture != texture) {
+            texture = command->draw.texture;
+            stats->texture_changes++;
+        }
+        if (command->draw.vertex_array != vertex_array) {
+            vertex_array = command->draw.vertex_array;
+            stats->vertex_array_changes++;
+        }
+        stats->draws++;
+    }
+}
+
+// Sort the frame's render commands by key and run them, issuing GL state
+// changes only where a command differs from the one before it.
+// Without a GPU the commands are sorted and counted but nothing is drawn,
+// which still measures everything up to the driver.
+static RenderCommandStats execute_render_commands(RenderCommandBuffer* buffer, MemoryArena* scratch, bool has_gpu) {
+    RenderCommandStats stats = {0};
+    stats.commands = buffer->count;
+    if (buffer->dropped) {
+        printf("Render command buffer full, %u commands dropped\n", buffer->dropped);
+    }
     
-    printf("=== Hot Reload Engine Starting ===\n");
-    printf("Platform: %s\n", PLATFORM_NAME);
+    ArenaMarker marker = arena_begin_temp(scratch);
+    uint32_t* order = arena_push_array(scratch, uint32_t, buffer->count, MEMORY_TAG_SCRATCH);
+    if (!order) {
+        arena_end_temp(marker);
+        return stats;
+    }
+    render_commands_sort(buffer->commands, buffer->count, order, scratch);
+    if (!has_gpu) {
+        count_render_commands(buffer, order, &stats);
+        arena_end_temp(marker);
+        return stats;
+    }
     
-    // Initialize SDL
-    if (SDL_Init(SDL_INIT_VIDEO) < 0) {
-        printf("SDL initialization failed: %s\n", SDL_GetError());
-        return 1;
+    // Nothing is assumed about state left by whatever drew last
+    uint32_t program = UINT32_MAX;
+    uint32_t texture = UINT32_MAX;
+    uint32_t vertex_array = UINT32_MAX;
+    uint32_t state = 0;
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+    glActiveTexture(GL_TEXTURE0);
+    
+    for (uint32_t i = 0; i < buffer->count; i++) {
+        const RenderCommand* command = &buffer->commands[order[i]];
+        switch (command->type) {
+            case RENDER_COMMAND_CLEAR:
+                glClearColor(command->clear.color[0], command->clear.color[1], command->clear.color[2], command->clear.color[3]);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                break;
+            
+            case RENDER_COMMAND_DRAW: {
+                if (command->state != state) {
+                    set_render_state(command->state, &state);
+                    stats.state_changes++;
+                }
+                if (command->draw.program != program) {
+                    glUseProgram(command->draw.program);
+                    program = command->draw.program;
+                    stats.program_changes++;
+                }
+                if (command->draw.texture != texture) {
+                    glBindTexture(GL_TEXTURE_2D, command->draw.texture);
+                    texture = command->draw.texture;
+                    stats.texture_changes++;
+                }
+                if (command->draw.vertex_array != vertex_array) {
+                    glBindVertexArray(command->draw.vertex_array);
+                    vertex_array = command->draw.vertex_array;
+                    stats.vertex_array_changes++;
+                }
+                if (command->draw.transform && command->draw.transform_location >= 0) {
+                    glUniformMatrix4fv(command->draw.transform_location, 1, GL_FALSE, command->draw.transform);
+                }
+                
+                if (command->draw.instance_count == 0) {
+                    glDrawArrays(command->draw.primitive, (GLint)command->draw.first, (GLsizei)command->draw.count);
+                } else {
+                    // GL 3.3 has no base instance, so the instance attributes
+                    // are pointed at this draw's first instance
+                    const RenderInstanceLayout* layout = command->draw.instance_layout;
+                    glBindBuffer(GL_ARRAY_BUFFER, command->draw.instance_buffer);
+                    for (uint32_t a = 0; layout && a < layout->attribute_count; a++) {
+                        const RenderInstanceAttribute* attribute = &layout->attributes[a];
+                        glVertexAttribPointer((GLuint)attribute->location, attribute->size, attribute->type,
+                                              attribute->normalized ? GL_TRUE : GL_FALSE, (GLsizei)layout->stride,
+                                              (const void*)(uintptr_t)(command->draw.instance_offset + attribute->offset));
+                        glVertexAttribDivisor((GLuint)attribute->location, 1);
+                        glEnableVertexAttribArray((GLuint)attribute->location);
+                    }
+                    glBindBuffer(GL_ARRAY_BUFFER, 0);
+                    glDrawArraysInstanced(command->draw.primitive, (GLint)command->draw.first,
+                                          (GLsizei)command->draw.count, (GLsizei)command->draw.instance_count);
+                }
+                stats.draws++;
+                break;
+            }
+            
+            case RENDER_COMMAND_FENCE:
+                *command->fence.sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+                break;
+        }
     }
     
+    glBindVertexArray(0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    set_render_state(RENDER_STATE_DEPTH_TEST, &state);
+    arena_end_temp(marker);
+    return stats;
+}
+
+// Warn when an allocator's high-water mark passes this fraction of its size
+#define MEMORY_WARNING_FRACTION 0.8
+#define MEMORY_OVERLAY_WIDTH 320
+#define MEMORY_OVERLAY_BAR_HEIGHT 10
+
+static const float memory_tag_colors[][3] = {
+    { 0.5f, 0.5f, 0.5f },  // untagged
+    { 0.9f, 0.3f, 0.9f },  // migration
+    { 0.2f, 0.8f, 0.3f },  // gameplay
+    { 0.2f, 0.5f, 1.0f },  // render
+    { 1.0f, 0.8f, 0.2f },  // scratch
+};
+
+static void format_bytes(char* out, size_t out_size, uint64_t bytes) {
+    if (bytes >= (1u << 20)) {
+        snprintf(out, out_size, "%.1fMB", (double)bytes / (1u << 20));
+    } else if (bytes >= (1u << 10)) {
+        snprintf(out, out_size, "%.1fKB", (double)bytes / (1u << 10));
+    } else {
+        snprintf(out, out_size, "%lluB", (unsigned long long)bytes);
+    }
+}
+
+// "name used/committed of reserved, peak P [tag current/peak xN ...]",
+// skipping unused tags
+static void print_allocator_stats(const char* name, uint64_t used, uint64_t committed, uint64_t size,
+                                  uint64_t peak, const MemoryTagStats* tags) {
+    char used_text[16], committed_text[16], size_text[16], peak_text[16];
+    format_bytes(used_text, sizeof(used_text), used);
+    format_bytes(committed_text, sizeof(committed_text), committed);
+    format_bytes(size_text, sizeof(size_text), size);
+    format_bytes(peak_text, sizeof(peak_text), peak);
+    printf("%s %s/%s of %s, peak %s [", name, used_text, committed_text, size_text, peak_text);
+    bool first = true;
+    for (int tag = 0; tag < MEMORY_TAG_COUNT; tag++) {
+        if (tags[tag].peak_bytes == 0 && tags[tag].allocations == 0) {
+            continue;
+        }
+        format_bytes(used_text, sizeof(used_text), tags[tag].current_bytes);
+        format_bytes(peak_text, sizeof(peak_text), tags[tag].peak_bytes);
+        printf("%s%s %s/%s x%u", first ? "" : ", ", memory_tag_name(tag), used_text, peak_text, tags[tag].allocations);
+        if (tags[tag].frees) {
+            printf(" -%u", tags[tag].frees);
+        }
+        first = false;
+    }
+    printf("]");
+}
+
+// One line covering the frame arena as this frame left it and the persistent
+// heap, if a module has created one
+static void print_memory_report(const EngineState* state, Uint64 frame_index) {
+    const MemoryArena* arena = &state->frame_arena;
+    printf("Memory @%llu: ", (unsigned long long)frame_index);
+    print_allocator_stats("frame", arena->used, arena->committed, arena->size, arena->peak, arena->tags);
+    PersistentHeap* heap = persistent_heap_find(state->persistent_memory);
+    if (heap) {
+        printf(" | ");
+        print_allocator_stats("heap", heap->used, heap->committed, heap->size, heap->peak, heap->tags);
+    }
+    printf("\n");
+}
+
+// Warn once each time a high-water mark crosses another tenth of the
+// allocator's size past the warning threshold, so a slow climb is reported
+// without logging every frame
+static void check_memory_budget(const char* name, uint64_t peak, uint64_t size, int* warned_tenths) {
+    if (size == 0 || (double)peak < (double)size * MEMORY_WARNING_FRACTION) {
+        return;
+    }
+    int tenths = (int)(peak * 10 / size);
+    if (tenths > *warned_tenths) {
+        *warned_tenths = tenths;
+        printf("WARNING: %s memory at %.0f%% of its %llu MB (peak %llu bytes)\n",
+               name, 100.0 * (double)peak / (double)size,
+               (unsigned long long)(size >> 20), (unsigned long long)peak);
+    }
+}
+
+// One bar per allocator in the top left corner standing for its committed
+// memory, split into a colored segment per tag. Drawn with scissored clears
+// so it needs no shader or buffers.
+static void draw_memory_bar(int y, uint64_t size, const MemoryTagStats* tags, int window_height) {
+    glScissor(10, window_height - y - MEMORY_OVERLAY_BAR_HEIGHT, MEMORY_OVERLAY_WIDTH, MEMORY_OVERLAY_BAR_HEIGHT);
+    glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    int x = 10;
+    for (int tag = 0; tag < MEMORY_TAG_COUNT && size > 0; tag++) {
+        int width = (int)(tags[tag].current_bytes * MEMORY_OVERLAY_WIDTH / size);
+        if (tags[tag].current_bytes > 0 && width == 0) {
+            width = 1;
+        }
+        if (width == 0) {
+            continue;
+        }
+        const float* color = memory_tag_colors[tag % (int)(sizeof(memory_tag_colors) / sizeof(memory_tag_colors[0]))];
+        glScissor(x, window_height - y - MEMORY_OVERLAY_BAR_HEIGHT, width, MEMORY_OVERLAY_BAR_HEIGHT);
+        glClearColor(color[0], color[1], color[2], 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        x += width;
+    }
+}
+
+static void draw_memory_overlay(const EngineState* state) {
+    glEnable(GL_SCISSOR_TEST);
+    draw_memory_bar(10, state->frame_arena.committed, state->frame_arena.tags, state->window_height);
+    PersistentHeap* heap = persistent_heap_find(state->persistent_memory);
+    if (heap) {
+        draw_memory_bar(14 + MEMORY_OVERLAY_BAR_HEIGHT, heap->committed, heap->tags, state->window_height);
+    }
+    glDisable(GL_SCISSOR_TEST);
+}
+
+// Headless runs without --frames or --seconds stop after this many frames
+#define HEADLESS_DEFAULT_FRAMES 1000
+
+// Window with a current GL 3.3 core context and GL loaded. Headless windows
+// come from the offscreen video driver and are never shown, and swaps are
+// not synced to a display.
+static bool create_gl_window(bool headless, SDL_Window** window_out, SDL_GLContext* context_out) {
     // Set OpenGL attributes
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
@@ -238,13 +1094,12 @@ int main(int argc, char* argv[]) {
     SDL_Window* window = SDL_CreateWindow(
         "Hot Reload Engine",
         800, 600,
-        SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE
+        SDL_WINDOW_OPENGL | (headless ? SDL_WINDOW_HIDDEN : SDL_WINDOW_RESIZABLE)
     );
     
     if (!window) {
         printf("Window creation failed: %s\n", SDL_GetError());
-        SDL_Quit();
-        return 1;
+        return false;
     }
     
     // Create OpenGL context
@@ -252,44 +1107,193 @@ int main(int argc, char* argv[]) {
     if (!gl_context) {
         printf("OpenGL context creation failed: %s\n", SDL_GetError());
         SDL_DestroyWindow(window);
-        SDL_Quit();
-        return 1;
+        return false;
     }
     
-    // Enable vsync
-    SDL_GL_SetSwapInterval(1);
+    // Enable vsync, except when measuring throughput
+    SDL_GL_SetSwapInterval(headless ? 0 : 1);
     
     // Load OpenGL functions with GLAD
     if (!gladLoadGLLoader((GLADloadproc)SDL_GL_GetProcAddress)) {
         printf("Failed to initialize GLAD\n");
-       // SDL_GL_DeleteContext(gl_context);
+        // Headless runs carry on without a GPU, so don't leave the
+        // context behind or current
+        SDL_GL_DestroyContext(gl_context);
         SDL_DestroyWindow(window);
-        SDL_Quit();
-        return 1;
+        return false;
     }
     
     printf("OpenGL Version: %s\n", glGetString(GL_VERSION));
     printf("GLSL Version: %s\n", glGetString(GL_SHADING_LANGUAGE_VERSION));
+    printf("OpenGL Renderer: %s\n", glGetString(GL_RENDERER));
     
     // Set up OpenGL state
     glViewport(0, 0, 800, 600);
     glEnable(GL_DEPTH_TEST);
     
+    *window_out = window;
+    *context_out = gl_context;
+    return true;
+}
+
+// Frame durations kept for the end of run summary
+typedef struct {
+    float* seconds;
+    size_t count;
+    size_t capacity;
+    RenderCommandStats render_totals;
+} FrameStats;
+
+static void record_frame(FrameStats* stats, float seconds, const RenderCommandStats* render) {
+    if (stats->count == stats->capacity) {
+        size_t capacity = stats->capacity ? stats->capacity * 2 : 4096;
+        float* grown = realloc(stats->seconds, capacity * sizeof(float));
+        if (!grown) {
+            return;
+        }
+        stats->seconds = grown;
+        stats->capacity = capacity;
+    }
+    stats->seconds[stats->count++] = seconds;
+    stats->render_totals.commands += render->commands;
+    stats->render_totals.draws += render->draws;
+    stats->render_totals.program_changes += render->program_changes;
+    stats->render_totals.texture_changes += render->texture_changes;
+    stats->render_totals.vertex_array_changes += render->vertex_array_changes;
+    stats->render_totals.state_changes += render->state_changes;
+}
+
+static int compare_floats(const void* a, const void* b) {
+    float fa = *(const float*)a;
+    float fb = *(const float*)b;
+    return (fa > fb) - (fa < fb);
+}
+
+static void print_frame_stats(FrameStats* stats) {
+    if (stats->count == 0) {
+        printf("No frames measured\n");
+        return;
+    }
+    
+    double total = 0.0;
+    for (size_t i = 0; i < stats->count; i++) {
+        total += stats->seconds[i];
+    }
+    // Sorted in place; the samples aren't needed in order any more
+    qsort(stats->seconds, stats->count, sizeof(float), compare_floats);
+    #define FRAME_PERCENTILE(p) (stats->seconds[(size_t)((stats->count - 1) * (p))] * 1000.0)
+    
+    double n = (double)stats->count;
+    printf("\n=== Frame statistics (%zu frames, %.2f s) ===\n", stats->count, total);
+    printf("Average: %.3f ms (%.1f fps)\n", total * 1000.0 / n, n / total);
+    printf("Min %.3f  p50 %.3f  p95 %.3f  p99 %.3f  max %.3f ms\n",
+           stats->seconds[0] * 1000.0, FRAME_PERCENTILE(0.50), FRAME_PERCENTILE(0.95),
+           FRAME_PERCENTILE(0.99), stats->seconds[stats->count - 1] * 1000.0);
+    printf("Per frame: %.1f commands, %.1f draws, %.1f program / %.1f texture / %.1f vertex array / %.1f state changes\n",
+           stats->render_totals.commands / n, stats->render_totals.draws / n,
+           stats->render_totals.program_changes / n, stats->render_totals.texture_changes / n,
+           stats->render_totals.vertex_array_changes / n, stats->render_totals.state_changes / n);
+    #undef FRAME_PERCENTILE
+}
+
+static void print_usage(const char* program) {
+    printf("usage: %s [--frames N] [--seconds S] [--headless] [--scripted-input] [--hugetlb]\n"
+           "       [--state-file PATH] [--rewind-frames N] [--memory-report N]\n", program);
+    printf("  --frames N        exit after N frames\n");
+    printf("  --seconds S       exit after S seconds\n");
+    printf("  --headless        no window or vsync; print frame time statistics at exit\n"
+           "                    (offscreen GL if available, else no GPU at all)\n");
+    printf("  --scripted-input  replace the keyboard with a fixed input script\n");
+    printf("  --hugetlb         back persistent memory with reserved huge pages\n");
+    printf("  --state-file PATH keep persistent memory in PATH across restarts\n");
+    printf("  --rewind-frames N keep N frames of history; F8 rewinds %d frames\n", REWIND_STEP_FRAMES);
+    printf("  --memory-report N log memory use every N frames; F7 shows it on screen\n");
+}
+
+int main(int argc, char* argv[]) {
+    // Install signal handlers for debugging
+    signal(SIGSEGV, signal_handler);
+    signal(SIGABRT, signal_handler);
+    
+    Uint64 max_frames = 0;
+    float max_seconds = 0.0f;
+    bool headless = false;
+    bool scripted_input = false;
+    bool use_hugetlb = false;
+    const char* state_file = NULL;
+    int rewind_frames = 0;
+    Uint64 memory_report_interval = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            max_frames = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            max_seconds = strtof(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--headless") == 0) {
+            headless = true;
+        } else if (strcmp(argv[i], "--scripted-input") == 0) {
+            scripted_input = true;
+        } else if (strcmp(argv[i], "--hugetlb") == 0) {
+            use_hugetlb = true;
+        } else if (strcmp(argv[i], "--state-file") == 0 && i + 1 < argc) {
+            state_file = argv[++i];
+        } else if (strcmp(argv[i], "--rewind-frames") == 0 && i + 1 < argc) {
+            rewind_frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--memory-report") == 0 && i + 1 < argc) {
+            memory_report_interval = strtoull(argv[++i], NULL, 10);
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    
+    printf("=== Hot Reload Engine Starting ===\n");
+    printf("Platform: %s\n", PLATFORM_NAME);
+    
+    if (headless && max_frames == 0 && max_seconds <= 0.0f) {
+        max_frames = HEADLESS_DEFAULT_FRAMES;
+    }
+    
+    // Initialize SDL. Headless runs use the offscreen video driver, which
+    // gets GL through EGL without a display (llvmpipe on GPU-less hosts).
+    if (headless) {
+        SDL_SetHint(SDL_HINT_VIDEO_DRIVER, "offscreen");
+    }
+    if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+        printf("SDL initialization failed: %s\n", SDL_GetError());
+        return 1;
+    }
+    
+    SDL_Window* window = NULL;
+    SDL_GLContext gl_context = NULL;
+    if (!create_gl_window(headless, &window, &gl_context)) {
+        if (!headless) {
+            SDL_Quit();
+            return 1;
+        }
+        printf("Headless: no OpenGL, running without a GPU\n");
+    }
+    const bool has_gpu = window != NULL;
+    
     // Compile shaders in main (since OpenGL state isn't shared)
-    unsigned int basic_shader = compile_shader(basic_vertex_shader, basic_fragment_shader);
+    unsigned int basic_shader = has_gpu ? compile_shader(basic_vertex_shader, basic_fragment_shader) : 0;
     
-    // Allocate persistent memory for engine
-    const size_t persistent_size = 64 * 1024 * 1024; // 64MB
-    const size_t frame_size = 16 * 1024 * 1024;      // 16MB
+    // Reserve address space for the engine's memory. Only what the
+    // allocators grow into is committed, so these are ceilings, not costs.
+    const size_t persistent_size = (size_t)16 * 1024 * 1024 * 1024; // 16GB, a multiple of HUGE_PAGE_SIZE
+    const size_t frame_size = (size_t)4 * 1024 * 1024 * 1024;       // 4GB
     
-    void* persistent_memory = malloc(persistent_size);
-    void* frame_memory = malloc(frame_size);
+    void* persistent_memory = state_file ? map_persistent_state_file(state_file, persistent_size)
+                                         : map_persistent_memory(persistent_size, use_hugetlb);
+    void* frame_memory = vm_reserve(frame_size);
     
-    if (!persistent_memory || !frame_memory) {
+    if (!persistent_memory || !frame_memory || !commit_persistent_memory(persistent_memory)) {
         printf("Failed to allocate memory\n");
         return 1;
     }
     
+    // Tell this process's GL handles apart from any stored by earlier runs
+    const int64_t session_seed[2] = { getpid(), reload_timing_now() };
+    
     // Initialize engine state
     EngineState engine_state = {
         .persistent_memory = persistent_memory,
@@ -298,6 +1302,8 @@ int main(int argc, char* argv[]) {
         .frame_memory_size = frame_size,
         .window = window,
         .gl_context = gl_context,
+        .has_gpu = has_gpu,
+        .session_id = hash_bytes(session_seed, sizeof(session_seed), HASH_SEED),
         .basic_shader_program = basic_shader,
         .delta_time = 0.0f,
         .total_time = 0.0f,
@@ -308,67 +1314,109 @@ int main(int argc, char* argv[]) {
         .window_width = 800,
         .window_height = 600,
         .should_quit = false,
-        .is_reloaded = false
+        .is_reloaded = false,
+        .is_shutting_down = false
     };
+    arena_init_reserved(&engine_state.frame_arena, frame_memory, frame_size, FRAME_COMMIT_GRANULARITY);
+    
+    // Module library paths
+    for (int i = 0; i < ENGINE_MODULE_COUNT; i++) {
+        EngineModule* module = &engine_modules[i];
+        snprintf(module->stem, sizeof(module->stem), "lib%s", module->name);
+        snprintf(module->lib_path, sizeof(module->lib_path), "lib%s" DYLIB_EXTENSION, module->name);
+        
+        // Check if the module library exists
+        if (access(module->lib_path, F_OK) != 0) {
+            printf("ERROR: Engine library '%s' not found!\n", module->lib_path);
+            printf("Make sure to build the engine libraries first.\n");
+            return 1;
+        }
+        
+        remove_stale_staged_libraries(module->stem);
+    }
     
-    // Engine library paths
-    const char* lib_name = "libengine" DYLIB_EXTENSION;
-    const char* temp_lib_name = "./libengine_temp" DYLIB_EXTENSION;  // Force current directory
+    shared_reload_timing = reload_timing_map();
+    if (shared_reload_timing) {
+        last_build_sequence = shared_reload_timing->sequence;
+    } else {
+        printf("Reload timing unavailable: could not map %s\n", RELOAD_TIMING_FILE);
+    }
     
-    // Check if engine library exists
-    if (access(lib_name, F_OK) != 0) {
-        printf("ERROR: Engine library '%s' not found!\n", lib_name);
-        printf("Make sure to build the engine library first.\n");
-        return 1;
+    // Load and initialize every module in table order
+    for (int i = 0; i < ENGINE_MODULE_COUNT; i++) {
+        EngineModule* module = &engine_modules[i];
+        printf("DEBUG: Loading %s module from %s\n", module->name, module->lib_path);
+        if (!load_engine_library(&module->live, module)) {
+            printf("Failed to load %s\n", module->lib_path);
+            return 1;
+        }
+        printf("DEBUG: Calling %s_init\n", module->name);
+        module->live.init(&engine_state);
+        printf("DEBUG: %s_init completed\n", module->name);
     }
     
-    // Load engine library
-    EngineLibrary engine = {0};
-    printf("DEBUG: Loading engine library from %s\n", lib_name);
-    if (!load_engine_library(&engine, lib_name, temp_lib_name)) {
-        printf("Failed to load engine library\n");
-        return 1;
+    // Watch for rebuilt module libraries off the main thread
+    LibraryWatcher watcher = {0};
+    if (!start_library_watcher(&watcher)) {
+        printf("Hot reload disabled\n");
     }
-    printf("DEBUG: Engine library loaded successfully\n");
     
-    // Initialize engine
-    printf("DEBUG: Calling engine.init\n");
-    if (engine.init) {
-        engine.init(&engine_state);
-        printf("DEBUG: engine.init completed\n");
-    } else {
-        printf("ERROR: engine.init is NULL!\n");
+    // Record persistent memory changes frame by frame so F8 can rewind
+    bool snapshots_enabled = false;
+    if (rewind_frames > 0) {
+        if (use_hugetlb && !state_file) {
+            printf("Rewind needs base pages, not available with --hugetlb\n");
+        } else {
+            // Pinned first, so nothing the tracker covers is ever decommitted
+            sync_heap_with_snapshots(persistent_memory, persistent_memory_committed(persistent_memory));
+            snapshots_enabled = snapshot_init(persistent_memory, persistent_memory_committed(persistent_memory),
+                                              rewind_frames, REWIND_MAX_PAGES);
+        }
     }
+    // A heap that was pinned by an earlier run from the same state file
+    sync_heap_with_snapshots(persistent_memory, snapshot_tracked_size());
+    
+    // Modules swapped by the last reload; F9 toggles them with their fallbacks
+    uint32_t last_reload_mask = 0;
+    float next_flush_time = PERSISTENT_FLUSH_INTERVAL;
+    bool show_memory_overlay = false;
+    int frame_memory_warned = 0;
+    int heap_memory_warned = 0;
     
     // Main loop
     Uint64 last_time = SDL_GetPerformanceCounter();
+    Uint64 frame_index = 0;
+    FrameStats frame_stats = {0};
+    static bool scripted_keys[SDL_SCANCODE_COUNT];
     bool running = true;
     
     while (running && !engine_state.should_quit) {
-        // Check for library changes
-        time_t current_write_time = get_library_write_time(lib_name);
-        if (current_write_time != engine.last_write_time && current_write_time != 0) {
-            printf("\n=== Reloading engine library ===\n");
-            
-            // Call cleanup on old version
-            if (engine.cleanup) {
-                engine.cleanup(&engine_state);
-            }
-            
-            // Unload old library
-            unload_engine_library(&engine);
+        if (snapshots_enabled) {
+            // Pick up pages the heap committed last frame, after undoing
+            // any reset of its header by a module
+            sync_heap_with_snapshots(persistent_memory, snapshot_tracked_size());
+            snapshot_track(persistent_memory_committed(persistent_memory));
+            snapshot_next_frame();
+        }
+        
+        // Check for library changes flagged by the watcher
+        LibraryChanges changes;
+        if (take_library_changes(&watcher, &changes)) {
+            printf("\n=== Reloading engine modules ===\n");
             
-            // Wait a bit for file write to complete
-            sleep(1); // 100ms
+            begin_reload_timing(changes.notify_time);
             
-            // Load new library
-            if (load_engine_library(&engine, lib_name, temp_lib_name)) {
-                engine_state.is_reloaded = true;
-                engine.init(&engine_state);
-                printf("Engine reloaded successfully\n");
+            // Load and validate the new builds while the current ones stay live
+            uint32_t reloaded = reload_engine_modules(changes.mask, &engine_state);
+            if (reloaded) {
+                last_reload_mask = reloaded;
+                reload_stamps[RELOAD_STAGE_ENGINE_INITIALIZED] = reload_timing_now();
+                printf("Engine reloaded successfully (F9 reverts to the previous build)\n");
+                // Older frames were written by the code that was just replaced
+                snapshot_clear();
+                flush_persistent_memory(persistent_memory, false);
             } else {
-                printf("Failed to reload engine\n");
-                break;
+                reload_in_flight = false;
             }
         }
         
@@ -378,60 +1426,162 @@ int main(int argc, char* argv[]) {
         engine_state.total_time += engine_state.delta_time;
         last_time = current_time;
         
-        // Clear frame memory
-        memset(engine_state.frame_memory, 0, engine_state.frame_memory_size);
+        // Rewind frame memory; nothing is cleared
+        arena_reset(&engine_state.frame_arena);
+        render_commands_begin(&engine_state.render_commands, &engine_state.frame_arena, RENDER_COMMAND_CAPACITY);
         
         // Handle events
         SDL_Event event;
         while (SDL_PollEvent(&event)) {
             if (event.type == SDL_EVENT_QUIT) {
                 running = false;
+            } else if (event.type == SDL_EVENT_KEY_DOWN && event.key.key == SDLK_F9 && !event.key.repeat) {
+                bool reverted = false;
+                for (int i = 0; i < ENGINE_MODULE_COUNT; i++) {
+                    EngineModule* module = &engine_modules[i];
+                    if ((last_reload_mask & (1u << i)) && module->fallback.handle) {
+                        if (!reverted) {
+                            printf("\n=== Reverting to previous engine build ===\n");
+                        }
+                        swap_engine_library(&module->live, &module->fallback, &engine_state);
+                        reverted = true;
+                    }
+                }
+                if (reverted) {
+                    snapshot_clear();
+                } else {
+                    printf("No previous engine build to revert to\n");
+                }
+            } else if (event.type == SDL_EVENT_KEY_DOWN && event.key.key == SDLK_F8 && !event.key.repeat) {
+                if (snapshots_enabled) {
+                    // The restored heap header may predate commits that are
+                    // still in place and tracked
+                    snapshot_rewind(REWIND_STEP_FRAMES);
+                    sync_heap_with_snapshots(persistent_memory, snapshot_tracked_size());
+                } else {
+                    printf("Rewind is off, start with --rewind-frames N\n");
+                }
+            } else if (event.type == SDL_EVENT_KEY_DOWN && event.key.key == SDLK_F7 && !event.key.repeat) {
+                show_memory_overlay = !show_memory_overlay;
             } else if (event.type == SDL_EVENT_WINDOW_RESIZED) {
                 engine_state.window_width = event.window.data1;
                 engine_state.window_height = event.window.data2;
-                glViewport(0, 0, engine_state.window_width, engine_state.window_height);
+                if (has_gpu) {
+                    glViewport(0, 0, engine_state.window_width, engine_state.window_height);
+                }
             }
         }
         
         // Update input state
         engine_state.keyboard_state = SDL_GetKeyboardState(NULL);
+        if (scripted_input) {
+            update_scripted_input(scripted_keys, frame_index);
+            engine_state.keyboard_state = scripted_keys;
+        }
         engine_state.mouse_buttons = SDL_GetMouseState(&engine_state.mouse_x, &engine_state.mouse_y);
         
-        // Update engine
-        engine.update(&engine_state);
+        // Update modules
+        for (int i = 0; i < ENGINE_MODULE_COUNT; i++) {
+            if (engine_modules[i].live.update) {
+                engine_modules[i].live.update(&engine_state);
+            }
+        }
         
-        // Clear screen
-        GameState* game = (GameState*)engine_state.persistent_memory;
-
-        glClearColor(game->color_r, game->color_g, game->color_b, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        // Render modules record commands (the renderer records the clear
+        // itself), then they run in sort key order
+        for (int i = 0; i < ENGINE_MODULE_COUNT; i++) {
+            if (engine_modules[i].live.render) {
+                engine_modules[i].live.render(&engine_state);
+            }
+        }
+        RenderCommandStats render_stats = execute_render_commands(&engine_state.render_commands, &engine_state.frame_arena, has_gpu);
         
-        // Render engine
-        engine.render(&engine_state);
+        if (show_memory_overlay && has_gpu) {
+            draw_memory_overlay(&engine_state);
+        }
         
         // Swap buffers
-        SDL_GL_SwapWindow(window);
+        if (window) {
+            SDL_GL_SwapWindow(window);
+        }
+        
+        // delta_time is the whole previous frame, so frame 0 has nothing
+        if (headless && frame_index > 0) {
+            record_frame(&frame_stats, engine_state.delta_time, &render_stats);
+        }
+        
+        // The frame arena still holds everything pushed this frame
+        check_memory_budget("Frame", engine_state.frame_arena.peak, engine_state.frame_arena.size, &frame_memory_warned);
+        PersistentHeap* heap = persistent_heap_find(persistent_memory);
+        if (heap) {
+            check_memory_budget("Persistent heap", heap->peak, heap->size, &heap_memory_warned);
+        }
+        if (memory_report_interval != 0 && frame_index % memory_report_interval == 0) {
+            print_memory_report(&engine_state, frame_index);
+        }
+        
+        if (reload_in_flight) {
+            finish_reload_timing();
+        }
         
         // Reset reload flag
         engine_state.is_reloaded = false;
+        
+        // Write file-backed state out every few seconds, between frames
+        if (engine_state.total_time >= next_flush_time) {
+            flush_persistent_memory(persistent_memory, false);
+            next_flush_time = engine_state.total_time + PERSISTENT_FLUSH_INTERVAL;
+        }
+        
+        frame_index++;
+        if (max_frames != 0 && frame_index >= max_frames) {
+            running = false;
+        }
+        if (max_seconds > 0.0f && engine_state.total_time >= max_seconds) {
+            running = false;
+        }
+    }
+    
+    if (headless) {
+        print_frame_stats(&frame_stats);
+        free(frame_stats.seconds);
     }
     
     // Cleanup
     printf("\n=== Shutting down ===\n");
+    if (memory_report_interval != 0) {
+        print_memory_report(&engine_state, frame_index);
+    }
+    
+    stop_library_watcher(&watcher);
     
-    if (engine.cleanup) {
-        engine.cleanup(&engine_state);
+    if (snapshots_enabled) {
+        snapshot_shutdown();
     }
     
-    unload_engine_library(&engine);
+    // Shut modules down in reverse order of initialization
+    engine_state.is_shutting_down = true;
+    for (int i = ENGINE_MODULE_COUNT - 1; i >= 0; i--) {
+        EngineModule* module = &engine_modules[i];
+        if (module->live.cleanup) {
+            module->live.cleanup(&engine_state);
+        }
+        unload_engine_library(&module->live);
+        unload_engine_library(&module->fallback);
+    }
     
-    glDeleteProgram(basic_shader);
+    if (has_gpu) {
+        glDeleteProgram(basic_shader);
+    }
     
-    free(persistent_memory);
-    free(frame_memory);
+    flush_persistent_memory(persistent_memory, true);
+    munmap(persistent_memory, persistent_size + PERSISTENT_GUARD_SIZE);
+    vm_release(frame_memory, frame_size);
     
     //SDL_GL_DeleteContext(gl_context);
-    SDL_DestroyWindow(window);
+    if (window) {
+        SDL_DestroyWindow(window);
+    }
     SDL_Quit();
     
     return 0;
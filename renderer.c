@@ -0,0 +1,1094 @@
+// Rendering module: owns the GPU resources and draws the GameState that the
+// engine module simulates. It reloads independently of gameplay code.
+#include "engine_pch.h"
+#include "EngineState.h"
+#include "GameState.h"
+#include "Image.h"
+#include "TextureAtlas.h"
+#include <sys/stat.h>
+// Forward declarations for OpenGL types to avoid including GLAD
+typedef unsigned int GLuint;
+typedef int GLint;
+typedef int GLsizei;
+typedef unsigned int GLenum;
+typedef float GLfloat;
+typedef unsigned char GLboolean;
+typedef void GLvoid;
+typedef char GLchar;
+typedef unsigned int GLbitfield;
+typedef ptrdiff_t GLintptr;
+typedef ptrdiff_t GLsizeiptr;
+typedef uint64_t GLuint64;
+typedef struct __GLsync* GLsync;
+
+// Import the OpenGL functions we need from the main executable
+extern void glGenVertexArrays(GLsizei n, GLuint *arrays);
+extern void glGenBuffers(GLsizei n, GLuint *buffers);
+extern void glBindVertexArray(GLuint array);
+extern void glBindBuffer(GLenum target, GLuint buffer);
+extern void glBufferData(GLenum target, GLsizeiptr size, const GLvoid *data, GLenum usage);
+extern void* glMapBufferRange(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access);
+extern GLboolean glUnmapBuffer(GLenum target);
+extern GLenum glClientWaitSync(GLsync sync, GLbitfield flags, GLuint64 timeout);
+extern void glDeleteSync(GLsync sync);
+extern void glVertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const GLvoid *pointer);
+extern void glEnableVertexAttribArray(GLuint index);
+extern GLuint glCreateShader(GLenum type);
+extern void glShaderSource(GLuint shader, GLsizei count, const GLchar *const *string, const GLint *length);
+extern void glCompileShader(GLuint shader);
+extern void glGetShaderiv(GLuint shader, GLenum pname, GLint *params);
+extern void glGetShaderInfoLog(GLuint shader, GLsizei bufSize, GLsizei *length, GLchar *infoLog);
+extern void glDeleteShader(GLuint shader);
+extern GLuint glCreateProgram(void);
+extern void glAttachShader(GLuint program, GLuint shader);
+extern void glLinkProgram(GLuint program);
+extern void glGetProgramInfoLog(GLuint program, GLsizei bufSize, GLsizei *length, GLchar *infoLog);
+extern void glDeleteProgram(GLuint program);
+extern void glGenTextures(GLsizei n, GLuint *textures);
+extern void glBindTexture(GLenum target, GLuint texture);
+extern void glTexImage2D(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const GLvoid *pixels);
+extern void glTexParameteri(GLenum target, GLenum pname, GLint param);
+extern GLint glGetUniformLocation(GLuint program, const char *name);
+extern GLint glGetAttribLocation(GLuint program, const char *name);
+extern void glGetProgramiv(GLuint program, GLenum pname, GLint *params);
+extern void glGetActiveUniform(GLuint program, GLuint index, GLsizei bufSize, GLsizei *length, GLint *size, GLenum *type, GLchar *name);
+extern void glGetActiveAttrib(GLuint program, GLuint index, GLsizei bufSize, GLsizei *length, GLint *size, GLenum *type, GLchar *name);
+extern void glDeleteVertexArrays(GLsizei n, const GLuint *arrays);
+extern void glDeleteBuffers(GLsizei n, const GLuint *buffers);
+extern void glDeleteTextures(GLsizei n, const GLuint *textures);
+
+// OpenGL constants we need
+#define GL_ARRAY_BUFFER          0x8892
+#define GL_STATIC_DRAW           0x88E4
+#define GL_FLOAT                 0x1406
+#define GL_FALSE                 0
+#define GL_TRIANGLES             0x0004
+#define GL_ACTIVE_UNIFORMS       0x8B86
+#define GL_ACTIVE_ATTRIBUTES     0x8B89
+#define GL_STREAM_DRAW           0x88E0
+#define GL_TRIANGLE_STRIP        0x0005
+#define GL_UNSIGNED_BYTE         0x1401
+#define GL_TRUE                  1
+#define GL_MAP_WRITE_BIT              0x0002
+#define GL_MAP_INVALIDATE_RANGE_BIT   0x0004
+#define GL_MAP_UNSYNCHRONIZED_BIT     0x0020
+#define GL_SYNC_FLUSH_COMMANDS_BIT    0x00000001
+#define GL_ALREADY_SIGNALED      0x911A
+#define GL_CONDITION_SATISFIED   0x911C
+#define GL_WAIT_FAILED           0x911D
+#define GL_VERTEX_SHADER         0x8B31
+#define GL_FRAGMENT_SHADER       0x8B30
+#define GL_COMPILE_STATUS        0x8B81
+#define GL_LINK_STATUS           0x8B82
+#define GL_TEXTURE_2D            0x0DE1
+#define GL_RGBA                  0x1908
+#define GL_RGBA8                 0x8058
+#define GL_TEXTURE_MIN_FILTER    0x2801
+#define GL_TEXTURE_MAG_FILTER    0x2800
+#define GL_NEAREST               0x2600
+#define GL_LINEAR                0x2601
+
+// GPU resources that survive reloads. Entries are keyed by a stable name and
+// remember a hash of the data last uploaded, so reloaded code reuses the
+// existing GL objects and only re-uploads what actually changed.
+#define GPU_REGISTRY_MAGIC 0x47505553u
+#define GPU_REGISTRY_MAX_RESOURCES 1024
+
+typedef enum {
+    GPU_RESOURCE_VERTEX_ARRAY,
+    GPU_RESOURCE_BUFFER,
+    GPU_RESOURCE_TEXTURE,
+    GPU_RESOURCE_PROGRAM
+} GpuResourceKind;
+
+typedef struct {
+    uint64_t name_hash;
+    uint64_t content_hash;
+    uint32_t kind;
+    GLuint handle;
+} GpuResource;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t count;
+    uint64_t session_id;
+    GpuResource resources[GPU_REGISTRY_MAX_RESOURCES];
+} GpuRegistry;
+
+typedef char gpu_registry_fits[(sizeof(GpuRegistry) <= GPU_REGISTRY_CAPACITY) ? 1 : -1];
+
+static GpuRegistry* gpu_registry(EngineState* state) {
+    GpuRegistry* registry = (GpuRegistry*)((char*)state->persistent_memory + GPU_REGISTRY_OFFSET);
+    // Handles from another process belong to a GL context that no longer
+    // exists, so they are forgotten rather than deleted
+    if (registry->magic != GPU_REGISTRY_MAGIC || registry->session_id != state->session_id) {
+        memset(registry, 0, sizeof(*registry));
+        registry->magic = GPU_REGISTRY_MAGIC;
+        registry->session_id = state->session_id;
+    }
+    return registry;
+}
+
+// Find the named resource, creating the GL object on first use
+static GpuResource* gpu_acquire(EngineState* state, GpuResourceKind kind, const char* name, bool* created) {
+    GpuRegistry* registry = gpu_registry(state);
+    uint64_t name_hash = hash_string(name);
+    *created = false;
+    
+    for (uint32_t i = 0; i < registry->count; i++) {
+        GpuResource* resource = &registry->resources[i];
+        if (resource->name_hash == name_hash && resource->kind == (uint32_t)kind) {
+            return resource;
+        }
+    }
+    
+    if (registry->count == GPU_REGISTRY_MAX_RESOURCES) {
+        printf("GPU registry full, cannot create '%s'\n", name);
+        return NULL;
+    }
+    
+    GpuResource* resource = &registry->resources[registry->count++];
+    resource->name_hash = name_hash;
+    resource->content_hash = 0;
+    resource->kind = kind;
+    resource->handle = 0;
+    if (kind == GPU_RESOURCE_VERTEX_ARRAY) {
+        glGenVertexArrays(1, &resource->handle);
+    } else if (kind == GPU_RESOURCE_BUFFER) {
+        glGenBuffers(1, &resource->handle);
+    } else if (kind == GPU_RESOURCE_TEXTURE) {
+        glGenTextures(1, &resource->handle);
+    }
+    *created = true;
+    return resource;
+}
+
+// Returns the named buffer, uploading `data` only if it differs from what the
+// buffer already holds
+static GLuint gpu_buffer(EngineState* state, const char* name, GLenum target, const void* data, GLsizeiptr size, GLenum usage) {
+    bool created;
+    GpuResource* resource = gpu_acquire(state, GPU_RESOURCE_BUFFER, name, &created);
+    if (!resource) {
+        return 0;
+    }
+    
+    uint64_t content_hash = hash_bytes(data, (size_t)size, HASH_SEED);
+    if (created || resource->content_hash != content_hash) {
+        glBindBuffer(target, resource->handle);
+        glBufferData(target, size, data, usage);
+        glBindBuffer(target, 0);
+        resource->content_hash = content_hash;
+        printf("GPU registry: uploaded %s (%td bytes)\n", name, size);
+    }
+    return resource->handle;
+}
+
+// Returns the named vertex array. `*needs_setup` is set when the caller must
+// (re)specify its attributes, i.e. on creation or when `layout_hash` changed.
+static GLuint gpu_vertex_array(EngineState* state, const char* name, uint64_t layout_hash, bool* needs_setup) {
+    bool created;
+    GpuResource* resource = gpu_acquire(state, GPU_RESOURCE_VERTEX_ARRAY, name, &created);
+    *needs_setup = false;
+    if (!resource) {
+        return 0;
+    }
+    
+    if (created || resource->content_hash != layout_hash) {
+        resource->content_hash = layout_hash;
+        *needs_setup = true;
+    }
+    return resource->handle;
+}
+
+// Returns the named buffer with `size` bytes of storage and undefined
+// contents, for data that is rewritten every frame
+static GLuint gpu_stream_buffer(EngineState* state, const char* name, GLenum target, GLsizeiptr size) {
+    bool created;
+    GpuResource* resource = gpu_acquire(state, GPU_RESOURCE_BUFFER, name, &created);
+    if (!resource) {
+        return 0;
+    }
+    
+    if (created || resource->content_hash != (uint64_t)size) {
+        glBindBuffer(target, resource->handle);
+        glBufferData(target, size, NULL, GL_STREAM_DRAW);
+        glBindBuffer(target, 0);
+        resource->content_hash = (uint64_t)size;
+        printf("GPU registry: allocated %s (%td bytes)\n", name, size);
+    }
+    return resource->handle;
+}
+
+// Returns the named RGBA8 texture, uploading `pixels` only if they changed
+static GLuint gpu_texture(EngineState* state, const char* name, int width, int height, const void* pixels) {
+    bool created;
+    GpuResource* resource = gpu_acquire(state, GPU_RESOURCE_TEXTURE, name, &created);
+    if (!resource) {
+        return 0;
+    }
+    
+    uint64_t content_hash = hash_bytes(pixels, (size_t)width * height * 4, (uint64_t)width << 32 | (uint32_t)height);
+    if (created || resource->content_hash != content_hash) {
+        glBindTexture(GL_TEXTURE_2D, resource->handle);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        resource->content_hash = content_hash;
+        printf("GPU registry: uploaded %s (%dx%d)\n", name, width, height);
+    }
+    return resource->handle;
+}
+
+static GLuint compile_shader_stage(GLenum type, const char* source, const char* name) {
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+    
+    GLint success;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+    if (!success) {
+        char info_log[512];
+        glGetShaderInfoLog(shader, sizeof(info_log), NULL, info_log);
+        printf("%s %s shader compilation failed: %s\n", name, type == GL_VERTEX_SHADER ? "vertex" : "fragment", info_log);
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+// Returns the named program, rebuilding it when the sources change. A build
+// that fails to compile or link leaves the previous program in place.
+static GLuint gpu_program(EngineState* state, const char* name, const char* vertex_src, const char* fragment_src) {
+    bool created;
+    GpuResource* resource = gpu_acquire(state, GPU_RESOURCE_PROGRAM, name, &created);
+    if (!resource) {
+        return 0;
+    }
+    
+    uint64_t content_hash = hash_bytes(fragment_src, strlen(fragment_src), hash_string(vertex_src));
+    if (!created && resource->content_hash == content_hash) {
+        return resource->handle;
+    }
+    resource->content_hash = content_hash;
+    
+    GLuint vertex_shader = compile_shader_stage(GL_VERTEX_SHADER, vertex_src, name);
+    GLuint fragment_shader = compile_shader_stage(GL_FRAGMENT_SHADER, fragment_src, name);
+    GLuint program = 0;
+    if (vertex_shader && fragment_shader) {
+        program = glCreateProgram();
+        glAttachShader(program, vertex_shader);
+        glAttachShader(program, fragment_shader);
+        glLinkProgram(program);
+        
+        GLint success;
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        if (!success) {
+            char info_log[512];
+            glGetProgramInfoLog(program, sizeof(info_log), NULL, info_log);
+            printf("%s program linking failed: %s\n", name, info_log);
+            glDeleteProgram(program);
+            program = 0;
+        }
+    }
+    glDeleteShader(vertex_shader);
+    glDeleteShader(fragment_shader);
+    
+    if (program) {
+        glDeleteProgram(resource->handle);
+        resource->handle = program;
+        printf("GPU registry: built program %s\n", name);
+    }
+    return resource->handle;
+}
+
+static void gpu_delete(GpuResource* resource) {
+    switch (resource->kind) {
+        case GPU_RESOURCE_VERTEX_ARRAY: glDeleteVertexArrays(1, &resource->handle); break;
+        case GPU_RESOURCE_BUFFER:       glDeleteBuffers(1, &resource->handle); break;
+        case GPU_RESOURCE_TEXTURE:      glDeleteTextures(1, &resource->handle); break;
+        case GPU_RESOURCE_PROGRAM:      glDeleteProgram(resource->handle); break;
+    }
+}
+
+// Delete the named resource if it exists, for data that went away
+static void gpu_release(EngineState* state, GpuResourceKind kind, const char* name) {
+    GpuRegistry* registry = gpu_registry(state);
+    uint64_t name_hash = hash_string(name);
+    for (uint32_t i = 0; i < registry->count; i++) {
+        GpuResource* resource = &registry->resources[i];
+        if (resource->name_hash == name_hash && resource->kind == (uint32_t)kind) {
+            gpu_delete(resource);
+            *resource = registry->resources[--registry->count];
+            printf("GPU registry: released %s\n", name);
+            return;
+        }
+    }
+}
+
+static void gpu_registry_release_all(EngineState* state) {
+    GpuRegistry* registry = gpu_registry(state);
+    for (uint32_t i = 0; i < registry->count; i++) {
+        gpu_delete(&registry->resources[i]);
+    }
+    registry->count = 0;
+}
+
+// Shader program with its uniform and attribute locations looked up once,
+// when the program is (re)linked or this module is reloaded, instead of by
+// name on every draw. Code indexes the tables with the IDs below; a name the
+// program doesn't use stays at -1, which glUniform* quietly ignores.
+//
+// X(ID suffix, name in GLSL)
+#define SHADER_UNIFORMS(X) \
+    X(TRANSFORM,      "transform") \
+    X(SPRITE_TEXTURE, "sprite_texture")
+
+#define SHADER_ATTRIBUTES(X) \
+    X(POSITION,        "aPos") \
+    X(COLOR,           "aColor") \
+    X(CORNER,          "aCorner") \
+    X(SPRITE_POSITION, "iPosition") \
+    X(SPRITE_ROTATION, "iRotation") \
+    X(SPRITE_SCALE,    "iScale") \
+    X(SPRITE_UV_RECT,  "iUvRect") \
+    X(SPRITE_COLOR,    "iColor")
+
+typedef enum {
+#define SHADER_UNIFORM_ENUM(uniform_id, uniform_name) SHADER_UNIFORM_##uniform_id,
+    SHADER_UNIFORMS(SHADER_UNIFORM_ENUM)
+#undef SHADER_UNIFORM_ENUM
+    SHADER_UNIFORM_COUNT
+} ShaderUniform;
+
+typedef enum {
+#define SHADER_ATTRIBUTE_ENUM(attribute_id, attribute_name) SHADER_ATTRIBUTE_##attribute_id,
+    SHADER_ATTRIBUTES(SHADER_ATTRIBUTE_ENUM)
+#undef SHADER_ATTRIBUTE_ENUM
+    SHADER_ATTRIBUTE_COUNT
+} ShaderAttribute;
+
+static const char* const shader_uniform_names[SHADER_UNIFORM_COUNT] = {
+#define SHADER_UNIFORM_NAME(uniform_id, uniform_name) uniform_name,
+    SHADER_UNIFORMS(SHADER_UNIFORM_NAME)
+#undef SHADER_UNIFORM_NAME
+};
+
+static const char* const shader_attribute_names[SHADER_ATTRIBUTE_COUNT] = {
+#define SHADER_ATTRIBUTE_NAME(attribute_id, attribute_name) attribute_name,
+    SHADER_ATTRIBUTES(SHADER_ATTRIBUTE_NAME)
+#undef SHADER_ATTRIBUTE_NAME
+};
+
+typedef struct {
+    const char* name;
+    GLuint handle;
+    GLint uniforms[SHADER_UNIFORM_COUNT];
+    GLint attributes[SHADER_ATTRIBUTE_COUNT];
+} ShaderProgram;
+
+// Table slot for an active variable's name, or -1 if it has none. Arrays
+// are reported as "name[0]" and are matched by their base name.
+static int shader_find_name(const char* const* names, int count, char* name) {
+    char* bracket = strchr(name, '[');
+    if (bracket) {
+        *bracket = '\0';
+    }
+    for (int i = 0; i < count; i++) {
+        if (strcmp(names[i], name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Walk the program's active uniforms and attributes and fill the tables
+static void shader_program_reflect(ShaderProgram* program, const char* name, GLuint handle) {
+    program->name = name;
+    program->handle = handle;
+    for (int i = 0; i < SHADER_UNIFORM_COUNT; i++) {
+        program->uniforms[i] = -1;
+    }
+    for (int i = 0; i < SHADER_ATTRIBUTE_COUNT; i++) {
+        program->attributes[i] = -1;
+    }
+    if (!handle) {
+        return;
+    }
+    
+    GLint active_uniforms = 0;
+    GLint active_attributes = 0;
+    glGetProgramiv(handle, GL_ACTIVE_UNIFORMS, &active_uniforms);
+    glGetProgramiv(handle, GL_ACTIVE_ATTRIBUTES, &active_attributes);
+    
+    // Names without an ID are collected for a single message, since a
+    // variable the code can't reach is almost always a missing table entry
+    char variable[128];
+    char unknown[256] = "";
+    size_t unknown_length = 0;
+    GLint size;
+    GLenum type;
+    for (GLint i = 0; i < active_uniforms + active_attributes; i++) {
+        bool is_uniform = i < active_uniforms;
+        GLint location;
+        int slot;
+        if (is_uniform) {
+            glGetActiveUniform(handle, (GLuint)i, sizeof(variable), NULL, &size, &type, variable);
+            // Active index and location are different things; ask for the latter
+            location = glGetUniformLocation(handle, variable);
+            slot = shader_find_name(shader_uniform_names, SHADER_UNIFORM_COUNT, variable);
+        } else {
+            glGetActiveAttrib(handle, (GLuint)(i - active_uniforms), sizeof(variable), NULL, &size, &type, variable);
+            location = glGetAttribLocation(handle, variable);
+            slot = shader_find_name(shader_attribute_names, SHADER_ATTRIBUTE_COUNT, variable);
+        }
+        if (slot < 0) {
+            int written = snprintf(unknown + unknown_length, sizeof(unknown) - unknown_length, "%s %s '%s'",
+                                   unknown_length ? "," : "", is_uniform ? "uniform" : "attribute", variable);
+            if (written > 0 && (size_t)written < sizeof(unknown) - unknown_length) {
+                unknown_length += (size_t)written;
+            }
+        } else if (is_uniform) {
+            program->uniforms[slot] = location;
+        } else {
+            program->attributes[slot] = location;
+        }
+    }
+    printf("Shader %s reflected: %d uniforms, %d attributes\n", name, active_uniforms, active_attributes);
+    if (unknown_length) {
+        printf("Shader %s:%s have no ID and can't be set; add them to SHADER_UNIFORMS or SHADER_ATTRIBUTES\n",
+               name, unknown);
+    }
+}
+
+// Re-reflect only if `handle` is not the program the tables were built
+// for, i.e. after it was rebuilt
+static void shader_program_refresh(ShaderProgram* program, GLuint handle) {
+    if (program->handle != handle) {
+        shader_program_reflect(program, program->name, handle);
+    }
+}
+
+// Module globals are reset by a reload, so the tables are rebuilt by init
+static ShaderProgram basic_program;
+
+// Simple matrix operations
+typedef struct {
+    float m[16];
+} Mat4;
+
+static Mat4 mat4_identity() {
+    Mat4 result = {0};
+    result.m[0] = result.m[5] = result.m[10] = result.m[15] = 1.0f;
+    return result;
+}
+
+static Mat4 mat4_translate(float x, float y, float z) {
+    Mat4 result = mat4_identity();
+    result.m[12] = x;
+    result.m[13] = y;
+    result.m[14] = z;
+    return result;
+}
+
+static Mat4 mat4_scale(float x, float y, float z) {
+    Mat4 result = mat4_identity();
+    result.m[0] = x;
+    result.m[5] = y;
+    result.m[10] = z;
+    return result;
+}
+
+static Mat4 mat4_rotate_z(float angle) {
+    Mat4 result = mat4_identity();
+    float c = cosf(angle);
+    float s = sinf(angle);
+    result.m[0] = c;
+    result.m[1] = s;
+    result.m[4] = -s;
+    result.m[5] = c;
+    return result;
+}
+
+static Mat4 mat4_multiply(Mat4 a, Mat4 b) {
+    Mat4 result = {0};
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            for (int k = 0; k < 4; k++) {
+                result.m[i * 4 + j] += a.m[i * 4 + k] * b.m[k * 4 + j];
+            }
+        }
+    }
+    return result;
+}
+
+// Sprite batching. Per-sprite data goes straight into a streaming vertex
+// buffer split into SPRITE_RING_FRAMES regions, one per frame in flight.
+// Each frame maps its region unsynchronized, so the driver never stalls or
+// copies; a fence placed after the frame's draws says when the GPU is done
+// with the region, and is waited on before the region is written again.
+// Runs of sprites that share a program and texture become one instanced
+// draw command of a unit quad.
+#define SPRITE_RING_FRAMES 3
+#define SPRITE_MAX_PER_FRAME (256 * 1024)
+#define SPRITE_MAX_BATCHES 1024
+#define SPRITE_FENCE_TIMEOUT_NS 1000000000ull
+
+typedef struct {
+    float x, y;
+    float rotation;
+    float scale_x, scale_y;
+    // u0, v0, u1, v1 of the texture region
+    float uv_rect[4];
+    // RGBA, 8 bits per channel, red in the lowest byte
+    uint32_t color;
+} SpriteInstance;
+
+typedef struct {
+    ShaderProgram* program;
+    GLuint texture;
+    uint32_t first;
+    uint32_t count;
+} SpriteBatch;
+
+typedef struct {
+    GLuint ring_buffer;
+    GLuint vertex_array;
+    GLsync fences[SPRITE_RING_FRAMES];
+    uint32_t region;
+    
+    // Without a GPU, instances are written to frame memory instead so the
+    // CPU side can still be measured
+    MemoryArena* staging;
+    
+    // Mapped region for the current frame, NULL between frames
+    SpriteInstance* instances;
+    uint32_t instance_count;
+    uint32_t dropped;
+    SpriteBatch batches[SPRITE_MAX_BATCHES];
+    uint32_t batch_count;
+} SpriteRenderer;
+
+static SpriteRenderer sprites;
+
+static void sprite_wait_fence(GLsync* fence) {
+    if (!*fence) {
+        return;
+    }
+    GLenum result = glClientWaitSync(*fence, GL_SYNC_FLUSH_COMMANDS_BIT, SPRITE_FENCE_TIMEOUT_NS);
+    if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED) {
+        printf("Sprite ring fence wait %s\n", result == GL_WAIT_FAILED ? "failed" : "timed out");
+    }
+    glDeleteSync(*fence);
+    *fence = NULL;
+}
+
+static void sprite_renderer_init(EngineState* state, GLint corner) {
+    memset(&sprites, 0, sizeof(sprites));
+    if (!state->has_gpu) {
+        return;
+    }
+    
+    static const float corners[] = { -0.5f, -0.5f,  0.5f, -0.5f,  -0.5f, 0.5f,  0.5f, 0.5f };
+    GLuint quad = gpu_buffer(state, "sprite_quad_vbo", GL_ARRAY_BUFFER, corners, sizeof(corners), GL_STATIC_DRAW);
+    sprites.ring_buffer = gpu_stream_buffer(state, "sprite_ring_vbo", GL_ARRAY_BUFFER,
+                                            (GLsizeiptr)SPRITE_RING_FRAMES * SPRITE_MAX_PER_FRAME * sizeof(SpriteInstance));
+    
+    // Only the quad is part of the stored layout; instance attributes point
+    // at a different offset for every batch
+    const GLuint layout[] = { quad, (GLuint)corner, 2, 2, 0 };
+    bool needs_setup;
+    sprites.vertex_array = gpu_vertex_array(state, "sprite_vao", hash_bytes(layout, sizeof(layout), HASH_SEED), &needs_setup);
+    if (needs_setup && corner >= 0) {
+        glBindVertexArray(sprites.vertex_array);
+        glBindBuffer(GL_ARRAY_BUFFER, quad);
+        glVertexAttribPointer((GLuint)corner, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray((GLuint)corner);
+        glBindVertexArray(0);
+    }
+}
+
+// Wait for the GPU to finish with every region, so nothing is in flight when
+// this module is unloaded
+static void sprite_renderer_shutdown(void) {
+    for (int i = 0; i < SPRITE_RING_FRAMES; i++) {
+        sprite_wait_fence(&sprites.fences[i]);
+    }
+}
+
+static void sprite_begin_frame(EngineState* state) {
+    sprites.staging = state->has_gpu ? NULL : &state->frame_arena;
+    sprites.instance_count = 0;
+    sprites.dropped = 0;
+    sprites.batch_count = 0;
+}
+
+// Map the next region on the first push of a frame, so frames without
+// sprites don't touch the ring
+static bool sprite_map_region(void) {
+    if (sprites.staging) {
+        sprites.instances = arena_push_array(sprites.staging, SpriteInstance, SPRITE_MAX_PER_FRAME, MEMORY_TAG_RENDER);
+        return sprites.instances != NULL;
+    }
+    
+    sprites.region = (sprites.region + 1) % SPRITE_RING_FRAMES;
+    sprite_wait_fence(&sprites.fences[sprites.region]);
+    
+    GLsizeiptr region_size = (GLsizeiptr)SPRITE_MAX_PER_FRAME * sizeof(SpriteInstance);
+    glBindBuffer(GL_ARRAY_BUFFER, sprites.ring_buffer);
+    sprites.instances = (SpriteInstance*)glMapBufferRange(GL_ARRAY_BUFFER, sprites.region * region_size, region_size,
+                                                          GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return sprites.instances != NULL;
+}
+
+// Reserve `count` instances drawn with `program` and `texture`, extending
+// the last batch when they match. Returns NULL once the frame is full.
+static SpriteInstance* sprite_push(ShaderProgram* program, GLuint texture, uint32_t count) {
+    if (count == 0) {
+        return NULL;
+    }
+    if ((!sprites.instances && !sprite_map_region()) || sprites.instance_count + count > SPRITE_MAX_PER_FRAME) {
+        sprites.dropped += count;
+        return NULL;
+    }
+    
+    SpriteBatch* batch = sprites.batch_count ? &sprites.batches[sprites.batch_count - 1] : NULL;
+    if (!batch || batch->program != program || batch->texture != texture) {
+        if (sprites.batch_count == SPRITE_MAX_BATCHES) {
+            sprites.dropped += count;
+            return NULL;
+        }
+        batch = &sprites.batches[sprites.batch_count++];
+        batch->program = program;
+        batch->texture = texture;
+        batch->first = sprites.instance_count;
+        batch->count = 0;
+    }
+    
+    SpriteInstance* result = sprites.instances + sprites.instance_count;
+    batch->count += count;
+    sprites.instance_count += count;
+    return result;
+}
+
+// Where the sprite shader reads each SpriteInstance field. Sprite shaders
+// share these attribute locations, so one layout serves every batch.
+static RenderInstanceLayout sprite_layout;
+
+static void sprite_build_layout(const ShaderProgram* program) {
+    const struct {
+        ShaderAttribute id;
+        int32_t size;
+        uint32_t type;
+        uint32_t normalized;
+        uint32_t offset;
+    } fields[] = {
+        { SHADER_ATTRIBUTE_SPRITE_POSITION, 2, GL_FLOAT,         GL_FALSE, offsetof(SpriteInstance, x) },
+        { SHADER_ATTRIBUTE_SPRITE_ROTATION, 1, GL_FLOAT,         GL_FALSE, offsetof(SpriteInstance, rotation) },
+        { SHADER_ATTRIBUTE_SPRITE_SCALE,    2, GL_FLOAT,         GL_FALSE, offsetof(SpriteInstance, scale_x) },
+        { SHADER_ATTRIBUTE_SPRITE_UV_RECT,  4, GL_FLOAT,         GL_FALSE, offsetof(SpriteInstance, uv_rect) },
+        { SHADER_ATTRIBUTE_SPRITE_COLOR,    4, GL_UNSIGNED_BYTE, GL_TRUE,  offsetof(SpriteInstance, color) },
+    };
+    memset(&sprite_layout, 0, sizeof(sprite_layout));
+    sprite_layout.stride = sizeof(SpriteInstance);
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        GLint location = program->attributes[fields[i].id];
+        if (location < 0) {
+            continue;
+        }
+        RenderInstanceAttribute* attribute = &sprite_layout.attributes[sprite_layout.attribute_count++];
+        attribute->location = location;
+        attribute->size = fields[i].size;
+        attribute->type = fields[i].type;
+        attribute->normalized = fields[i].normalized;
+        attribute->offset = fields[i].offset;
+    }
+}
+
+// Unmap this frame's region, record a draw per batch and fence the region
+// behind them
+static void sprite_end_frame(RenderCommandBuffer* commands, const Mat4* view) {
+    if (!sprites.instances) {
+        return;
+    }
+    GLboolean intact = GL_TRUE;
+    if (!sprites.staging) {
+        glBindBuffer(GL_ARRAY_BUFFER, sprites.ring_buffer);
+        intact = glUnmapBuffer(GL_ARRAY_BUFFER);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    sprites.instances = NULL;
+    if (sprites.dropped) {
+        printf("Sprite batch full, %u sprites dropped\n", sprites.dropped);
+    }
+    if (!intact || sprites.batch_count == 0) {
+        return;
+    }
+    
+    const float* transform = render_push_transform(commands, view->m);
+    uint64_t region_offset = (uint64_t)sprites.region * SPRITE_MAX_PER_FRAME * sizeof(SpriteInstance);
+    for (uint32_t i = 0; i < sprites.batch_count; i++) {
+        const SpriteBatch* batch = &sprites.batches[i];
+        RenderCommand* command = render_command_push(commands, RENDER_COMMAND_DRAW,
+            render_sort_key(RENDER_LAYER_TRANSLUCENT, batch->program->handle, batch->texture, 0.5f));
+        if (!command) {
+            continue;
+        }
+        command->state = RENDER_STATE_ALPHA_BLEND;
+        command->draw.program = batch->program->handle;
+        command->draw.texture = batch->texture;
+        command->draw.vertex_array = sprites.vertex_array;
+        command->draw.primitive = GL_TRIANGLE_STRIP;
+        command->draw.count = 4;
+        command->draw.instance_count = batch->count;
+        command->draw.instance_buffer = sprites.ring_buffer;
+        command->draw.instance_offset = region_offset + (uint64_t)batch->first * sizeof(SpriteInstance);
+        command->draw.instance_layout = &sprite_layout;
+        command->draw.transform = transform;
+        command->draw.transform_location = batch->program->uniforms[SHADER_UNIFORM_TRANSFORM];
+    }
+    if (!sprites.staging) {
+        render_fence(commands, (void**)&sprites.fences[sprites.region]);
+    }
+}
+
+static const char* sprite_vertex_shader =
+    "#version 330 core\n"
+    "layout (location = 0) in vec2 aCorner;\n"
+    "layout (location = 1) in vec2 iPosition;\n"
+    "layout (location = 2) in float iRotation;\n"
+    "layout (location = 3) in vec2 iScale;\n"
+    "layout (location = 4) in vec4 iUvRect;\n"
+    "layout (location = 5) in vec4 iColor;\n"
+    "uniform mat4 transform;\n"
+    "out vec2 uv;\n"
+    "out vec4 tint;\n"
+    "void main() {\n"
+    "    float c = cos(iRotation);\n"
+    "    float s = sin(iRotation);\n"
+    "    vec2 p = aCorner * iScale;\n"
+    "    p = vec2(p.x * c - p.y * s, p.x * s + p.y * c) + iPosition;\n"
+    "    gl_Position = transform * vec4(p, 0.0, 1.0);\n"
+    "    uv = mix(iUvRect.xy, iUvRect.zw, aCorner + 0.5);\n"
+    "    tint = iColor;\n"
+    "}\n";
+
+static const char* sprite_fragment_shader =
+    "#version 330 core\n"
+    "in vec2 uv;\n"
+    "in vec4 tint;\n"
+    "uniform sampler2D sprite_texture;\n"
+    "out vec4 FragColor;\n"
+    "void main() {\n"
+    "    FragColor = texture(sprite_texture, uv) * tint;\n"
+    "}\n";
+
+static ShaderProgram sprite_program;
+static GLuint white_texture;
+
+// Sprite images come packed into atlas pages by atlas_packer (see
+// TextureAtlas.h), so sprites of different images share a texture and a
+// batch. Only the region table is kept; page pixels are loaded into frame
+// memory just long enough to upload them. The build tool repacks the atlas
+// when a sprite image changes, and the renderer reloads it when the table's
+// modification time does.
+#define SPRITE_ATLAS_PATH "assets/atlas"
+#define SPRITE_ATLAS_MAX_REGIONS 4096
+// Seconds between checks for a repacked atlas
+#define SPRITE_ATLAS_CHECK_INTERVAL 0.5f
+
+typedef struct {
+    AtlasRegion regions[SPRITE_ATLAS_MAX_REGIONS];
+    uint32_t region_count;
+    GLuint pages[ATLAS_MAX_PAGES];
+    uint32_t page_count;
+    // Of the table this was loaded from; zero if there was none
+    struct timespec mtime;
+} SpriteAtlas;
+
+static SpriteAtlas sprite_atlas;
+static float sprite_atlas_next_check;
+
+// Without an atlas every sprite is an untextured quad
+static const AtlasRegion sprite_untextured_region = { 0, 0, 0, 0, 1, 1, { 0.0f, 0.0f, 1.0f, 1.0f } };
+
+static void sprite_atlas_read(EngineState* state, const char* prefix) {
+    memset(&sprite_atlas, 0, sizeof(sprite_atlas));
+    char path[ATLAS_PATH_MAX];
+    snprintf(path, sizeof(path), "%s.atlas", prefix);
+    // Recorded even if the load fails, so a bad table is only tried once
+    struct stat table_stat;
+    if (stat(path, &table_stat) == 0) {
+        sprite_atlas.mtime = table_stat.st_mtim;
+    }
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        printf("No sprite atlas at %s, sprites are untextured\n", path);
+        return;
+    }
+    
+    AtlasHeader header;
+    AtlasPage pages[ATLAS_MAX_PAGES];
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+              header.magic == ATLAS_MAGIC && header.version == ATLAS_VERSION &&
+              header.page_count <= ATLAS_MAX_PAGES && header.region_count <= SPRITE_ATLAS_MAX_REGIONS &&
+              fread(pages, sizeof(AtlasPage), header.page_count, file) == header.page_count &&
+              fread(sprite_atlas.regions, sizeof(AtlasRegion), header.region_count, file) == header.region_count;
+    fclose(file);
+    if (!ok) {
+        printf("Sprite atlas %s is invalid or was written by another version\n", path);
+        return;
+    }
+    for (uint32_t i = 0; i < header.region_count; i++) {
+        if (sprite_atlas.regions[i].page >= header.page_count) {
+            printf("Sprite atlas %s has a region on page %u of %u\n", path, sprite_atlas.regions[i].page, header.page_count);
+            return;
+        }
+    }
+    sprite_atlas.region_count = header.region_count;
+    sprite_atlas.page_count = header.page_count;
+    
+    // Headless runs without a GPU only need the table
+    for (uint32_t page = 0; page < header.page_count && state->has_gpu; page++) {
+        ArenaMarker marker = arena_begin_temp(&state->frame_arena);
+        Image image;
+        char name[64];
+        atlas_page_path(path, sizeof(path), prefix, page);
+        snprintf(name, sizeof(name), "sprite_atlas_page_%u", page);
+        if (image_load(path, &image, &state->frame_arena) &&
+            (uint32_t)image.width == pages[page].width && (uint32_t)image.height == pages[page].height) {
+            sprite_atlas.pages[page] = gpu_texture(state, name, image.width, image.height, image.pixels);
+        } else {
+            printf("Sprite atlas page %s is missing or the wrong size, drawing it white\n", path);
+            sprite_atlas.pages[page] = white_texture;
+        }
+        arena_end_temp(marker);
+    }
+    printf("Sprite atlas: %u images on %u pages\n", sprite_atlas.region_count, sprite_atlas.page_count);
+}
+
+// Load the atlas and release the textures of pages it no longer has, which
+// an earlier load or the build before a reload may have created
+static void sprite_atlas_load(EngineState* state, const char* prefix) {
+    sprite_atlas_read(state, prefix);
+    for (uint32_t page = sprite_atlas.page_count; page < ATLAS_MAX_PAGES && state->has_gpu; page++) {
+        char name[64];
+        snprintf(name, sizeof(name), "sprite_atlas_page_%u", page);
+        gpu_release(state, GPU_RESOURCE_TEXTURE, name);
+    }
+}
+
+// Reload the atlas if the table changed since it was loaded
+static void sprite_atlas_refresh(EngineState* state, const char* prefix) {
+    if (state->total_time < sprite_atlas_next_check) {
+        return;
+    }
+    sprite_atlas_next_check = state->total_time + SPRITE_ATLAS_CHECK_INTERVAL;
+    
+    char path[ATLAS_PATH_MAX];
+    snprintf(path, sizeof(path), "%s.atlas", prefix);
+    struct stat table_stat;
+    if (stat(path, &table_stat) != 0 ||
+        (table_stat.st_mtim.tv_sec == sprite_atlas.mtime.tv_sec && table_stat.st_mtim.tv_nsec == sprite_atlas.mtime.tv_nsec)) {
+        return;
+    }
+    printf("Sprite atlas %s changed, reloading it\n", path);
+    sprite_atlas_load(state, prefix);
+}
+
+// Swarm of `game->sprite_count` sprites circling the player, to exercise
+// the batcher. The sprites cycle through every image in the atlas and are
+// pushed a page at a time, so the whole swarm is one draw per page.
+static void draw_sprite_swarm(EngineState* state, const GameState* game) {
+    uint32_t count = game->sprite_count > 0 ? (uint32_t)game->sprite_count : 0;
+    uint32_t region_count = sprite_atlas.region_count ? sprite_atlas.region_count : 1;
+    uint32_t page_count = sprite_atlas.region_count ? sprite_atlas.page_count : 1;
+    const AtlasRegion* regions = sprite_atlas.region_count ? sprite_atlas.regions : &sprite_untextured_region;
+    
+    // Sprite i shows region i % region_count, which makes the number of
+    // sprites on each page known up front
+    uint32_t page_counts[ATLAS_MAX_PAGES] = {0};
+    for (uint32_t r = 0; r < region_count; r++) {
+        page_counts[regions[r].page] += count / region_count + (r < count % region_count ? 1 : 0);
+    }
+    SpriteInstance* page_instances[ATLAS_MAX_PAGES];
+    for (uint32_t page = 0; page < page_count; page++) {
+        GLuint texture = sprite_atlas.region_count ? sprite_atlas.pages[page] : white_texture;
+        page_instances[page] = sprite_push(&sprite_program, texture, page_counts[page]);
+    }
+    
+    const float golden_angle = 2.39996323f;
+    for (uint32_t i = 0; i < count; i++) {
+        const AtlasRegion* region = &regions[i % region_count];
+        SpriteInstance** out = &page_instances[region->page];
+        if (!*out) {
+            continue;
+        }
+        float radius = 40.0f + 360.0f * sqrtf((float)(i + 1) / (float)count);
+        float angle = (float)i * golden_angle + state->total_time * (0.2f + 50.0f / radius);
+        uint32_t hash = (uint32_t)hash_bytes(&i, sizeof(i), HASH_SEED);
+        
+        SpriteInstance sprite;
+        sprite.x = game->player_x + cosf(angle) * radius;
+        sprite.y = game->player_y + sinf(angle) * radius;
+        sprite.rotation = angle;
+        sprite.scale_x = 3.0f + (float)(hash & 3);
+        sprite.scale_y = sprite.scale_x * (float)region->height / (float)region->width;
+        memcpy(sprite.uv_rect, region->uv_rect, sizeof(sprite.uv_rect));
+        sprite.color = (hash | 0x404040u) | 0xC0000000u;
+        // Whole struct at once: the mapped buffer may be write-combined
+        *(*out)++ = sprite;
+    }
+}
+
+// The player's trail from the level in the persistent heap, fading out
+// as the points age
+static void draw_trail(EngineState* state) {
+    PersistentHeap* heap = persistent_heap_find(state->persistent_memory);
+    GameLevel* level = game_level(heap);
+    if (!level || !level->trail_count) {
+        return;
+    }
+    SpriteInstance* out = sprite_push(&sprite_program, white_texture, level->trail_count);
+    if (!out) {
+        return;
+    }
+    const PersistentOffset* trail = PERSISTENT_PTR(heap, PersistentOffset, level->trail);
+    for (uint32_t i = 0; i < level->trail_count; i++) {
+        const TrailPoint* point = PERSISTENT_PTR(heap, TrailPoint, trail[i]);
+        float fade = 1.0f - point->age / GAME_TRAIL_LIFETIME;
+        uint32_t alpha = (uint32_t)(255.0f * (fade > 0.0f ? fade : 0.0f));
+        
+        SpriteInstance sprite;
+        sprite.x = point->x;
+        sprite.y = point->y;
+        sprite.rotation = 0.0f;
+        sprite.scale_x = 4.0f;
+        sprite.scale_y = 4.0f;
+        memcpy(sprite.uv_rect, sprite_untextured_region.uv_rect, sizeof(sprite.uv_rect));
+        sprite.color = 0x00FFFFFFu | alpha << 24;
+        *out++ = sprite;
+    }
+}
+
+void renderer_init(EngineState* state) {
+    printf("Renderer init called\n");
+    GameState* game = game_state(state->persistent_memory);
+    
+    shader_program_reflect(&basic_program, "basic_program", state->basic_shader_program);
+    if (!state->has_gpu) {
+        // Headless without GL: commands are still recorded, never executed
+        shader_program_reflect(&sprite_program, "sprite_program", 0);
+        sprite_renderer_init(state, -1);
+        sprite_atlas_load(state, SPRITE_ATLAS_PATH);
+        return;
+    }
+    GLint position = basic_program.attributes[SHADER_ATTRIBUTE_POSITION];
+    GLint color = basic_program.attributes[SHADER_ATTRIBUTE_COLOR];
+    
+    // Create a triangle
+    float vertices[] = {
+        // positions         // colors
+        -0.7f, -0.5f, 0.0f,  1.0f, 0.0f, 0.0f,
+         0.5f, -0.5f, 0.0f,  0.0f, 1.0f, 0.0f,
+         0.1f,  0.5f, 0.0f,  0.0f, 0.0f, 1.0f
+    };
+    
+    // Reuse the vertex array and buffer from before the reload; the data
+    // is only re-uploaded if the vertices changed
+    game->vbo = gpu_buffer(state, "triangle_vbo", GL_ARRAY_BUFFER, vertices, sizeof(vertices), GL_STATIC_DRAW);
+    
+    // Position (3 floats) and color (3 floats), interleaved
+    const GLuint layout[] = { game->vbo, (GLuint)position, 3, 6, 0, (GLuint)color, 3, 6, 3 };
+    bool needs_setup;
+    game->vao = gpu_vertex_array(state, "triangle_vao", hash_bytes(layout, sizeof(layout), HASH_SEED), &needs_setup);
+    
+    if (needs_setup) {
+        glBindVertexArray(game->vao);
+        glBindBuffer(GL_ARRAY_BUFFER, game->vbo);
+        
+        // Position attribute
+        if (position >= 0) {
+            glVertexAttribPointer((GLuint)position, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
+            glEnableVertexAttribArray((GLuint)position);
+        }
+        
+        // Color attribute
+        if (color >= 0) {
+            glVertexAttribPointer((GLuint)color, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
+            glEnableVertexAttribArray((GLuint)color);
+        }
+        
+        glBindVertexArray(0);
+    }
+    
+    // Sprites: one shader, with images from the atlas
+    GLuint sprite_handle = gpu_program(state, "sprite_program", sprite_vertex_shader, sprite_fragment_shader);
+    shader_program_reflect(&sprite_program, "sprite_program", sprite_handle);
+    sprite_build_layout(&sprite_program);
+    static const unsigned char white_pixel[4] = { 255, 255, 255, 255 };
+    white_texture = gpu_texture(state, "white_texture", 1, 1, white_pixel);
+    sprite_atlas_load(state, SPRITE_ATLAS_PATH);
+    sprite_renderer_init(state, sprite_program.attributes[SHADER_ATTRIBUTE_CORNER]);
+}
+
+void renderer_render(EngineState* state) {
+    GameState* game = game_state(state->persistent_memory);
+    RenderCommandBuffer* commands = &state->render_commands;
+    
+    // Clear with the game's color
+    render_clear(commands, game->color_r, game->color_g, game->color_b, 1.0f);
+    
+    // Use the shader program compiled in main.c
+    shader_program_refresh(&basic_program, state->basic_shader_program);
+    
+    // Calculate aspect ratio
+    float aspect = (float)state->window_width / state->window_height;
+    
+    // Create transformation matrix
+    Mat4 scale = mat4_scale(0.5f / aspect, 0.5f, 1.0f);
+    Mat4 rotate = mat4_rotate_z(game->player_rotation);
+    Mat4 translate = mat4_translate(game->player_x / 400.0f, game->player_y / 300.0f, 0.0f);
+    
+    Mat4 transform = mat4_multiply(translate, mat4_multiply(rotate, scale));
+    
+    RenderCommand* draw = render_command_push(commands, RENDER_COMMAND_DRAW,
+        render_sort_key(RENDER_LAYER_OPAQUE, basic_program.handle, 0, 0.5f));
+    if (draw) {
+        draw->state = RENDER_STATE_DEPTH_TEST;
+        draw->draw.program = basic_program.handle;
+        draw->draw.vertex_array = game->vao;
+        draw->draw.primitive = GL_TRIANGLES;
+        draw->draw.count = 3;
+        draw->draw.transform = render_push_transform(commands, transform.m);
+        draw->draw.transform_location = basic_program.uniforms[SHADER_UNIFORM_TRANSFORM];
+    }
+    
+    // Sprites share the player's units: pixels from the window center
+    sprite_atlas_refresh(state, SPRITE_ATLAS_PATH);
+    sprite_begin_frame(state);
+    draw_trail(state);
+    draw_sprite_swarm(state, game);
+    Mat4 view = mat4_scale(1.0f / 400.0f, 1.0f / 300.0f, 1.0f);
+    sprite_end_frame(commands, &view);
+    
+    // Draw some text info (would need text rendering in real app)
+    if (state->is_reloaded) {
+        printf("Reloaded! Position: (%.2f, %.2f), Rotation: %.2f, Reloads: %d\n", 
+               game->player_x, game->player_y, game->player_rotation, game->reload_count);
+    }
+}
+
+void renderer_cleanup(EngineState* state) {
+    printf("Renderer cleanup called\n");
+    sprite_renderer_shutdown();
+    
+    // GPU resources outlive reloads; only release them when the platform exits
+    if (state->is_shutting_down) {
+        GameState* game = game_state(state->persistent_memory);
+        gpu_registry_release_all(state);
+        game->vao = 0;
+        game->vbo = 0;
+    }
+}
@@ -0,0 +1,326 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include "snapshot.h"
+
+// One frame's saved pages: `page_count` consecutive slots starting at
+// `first_slot` in the page ring. `complete` is false if history was dropped
+// while the frame was recorded, so it can't be undone.
+typedef struct {
+    size_t first_slot;
+    size_t page_count;
+    bool complete;
+} SnapshotFrame;
+
+typedef struct {
+    unsigned char* base;
+    size_t size;
+    size_t page_size;
+    size_t page_count;
+
+    // Ring of saved page contents and the page each slot came from
+    unsigned char* slots;
+    uint32_t* slot_pages;
+    size_t slot_capacity;
+    size_t slot_tail;
+    size_t slots_used;
+
+    // Ring of frames; the newest one is the frame being recorded
+    SnapshotFrame* frames;
+    int frame_capacity;
+    int frame_tail;
+    int frame_count;
+
+    // Pages written during the current frame
+    unsigned char* dirty;
+    uint32_t* dirty_list;
+    size_t dirty_count;
+
+    volatile sig_atomic_t tracking;
+    bool handler_installed;
+    struct sigaction previous_action;
+} SnapshotTracker;
+
+static SnapshotTracker tracker;
+
+static SnapshotFrame* current_frame(void) {
+    return &tracker.frames[(tracker.frame_tail + tracker.frame_count - 1) % tracker.frame_capacity];
+}
+
+static void drop_oldest_frame(void) {
+    SnapshotFrame* oldest = &tracker.frames[tracker.frame_tail];
+    tracker.slot_tail = (tracker.slot_tail + oldest->page_count) % tracker.slot_capacity;
+    tracker.slots_used -= oldest->page_count;
+    tracker.frame_tail = (tracker.frame_tail + 1) % tracker.frame_capacity;
+    tracker.frame_count--;
+}
+
+// Drop every frame but the current one, which stays open but can no longer
+// be undone since some of its pages were already written without a copy
+static void drop_history(void) {
+    while (tracker.frame_count > 1) {
+        drop_oldest_frame();
+    }
+    SnapshotFrame* frame = current_frame();
+    tracker.slot_tail = (tracker.slot_tail + frame->page_count) % tracker.slot_capacity;
+    tracker.slots_used = 0;
+    frame->first_slot = tracker.slot_tail;
+    frame->page_count = 0;
+    frame->complete = false;
+}
+
+// Copy a page's contents before its first write this frame
+static void save_page(size_t page) {
+    SnapshotFrame* frame = current_frame();
+    if (!frame->complete) {
+        return;
+    }
+    while (tracker.slots_used == tracker.slot_capacity && tracker.frame_count > 1) {
+        drop_oldest_frame();
+    }
+    if (tracker.slots_used == tracker.slot_capacity) {
+        // This frame alone changed more pages than the ring holds
+        drop_history();
+        return;
+    }
+
+    size_t slot = (tracker.slot_tail + tracker.slots_used) % tracker.slot_capacity;
+    memcpy(tracker.slots + slot * tracker.page_size, tracker.base + page * tracker.page_size, tracker.page_size);
+    tracker.slot_pages[slot] = (uint32_t)page;
+    tracker.slots_used++;
+    frame->page_count++;
+}
+
+static void snapshot_fault_handler(int sig, siginfo_t* info, void* context) {
+    (void)sig;
+    (void)context;
+    unsigned char* address = (unsigned char*)info->si_addr;
+    if (!tracker.tracking || address < tracker.base || address >= tracker.base + tracker.size) {
+        // Not ours: put the previous handler back and let the access fault again
+        sigaction(SIGSEGV, &tracker.previous_action, NULL);
+        return;
+    }
+
+    size_t page = (size_t)(address - tracker.base) / tracker.page_size;
+    if (!tracker.dirty[page]) {
+        tracker.dirty[page] = 1;
+        tracker.dirty_list[tracker.dirty_count++] = (uint32_t)page;
+        save_page(page);
+    }
+    mprotect(tracker.base + page * tracker.page_size, tracker.page_size, PROT_READ | PROT_WRITE);
+}
+
+static int compare_pages(const void* a, const void* b) {
+    uint32_t page_a = *(const uint32_t*)a;
+    uint32_t page_b = *(const uint32_t*)b;
+    return (page_a > page_b) - (page_a < page_b);
+}
+
+// Make this frame's dirty pages read-only again, one call per run of pages
+static void protect_dirty_pages(void) {
+    qsort(tracker.dirty_list, tracker.dirty_count, sizeof(uint32_t), compare_pages);
+    size_t i = 0;
+    while (i < tracker.dirty_count) {
+        size_t first = tracker.dirty_list[i];
+        size_t count = 1;
+        while (i + count < tracker.dirty_count && tracker.dirty_list[i + count] == first + count) {
+            count++;
+        }
+        mprotect(tracker.base + first * tracker.page_size, count * tracker.page_size, PROT_READ);
+        for (size_t j = 0; j < count; j++) {
+            tracker.dirty[first + j] = 0;
+        }
+        i += count;
+    }
+    tracker.dirty_count = 0;
+}
+
+static void begin_frame(void) {
+    if (tracker.frame_count == tracker.frame_capacity) {
+        drop_oldest_frame();
+    }
+    tracker.frame_count++;
+    SnapshotFrame* frame = current_frame();
+    frame->first_slot = (tracker.slot_tail + tracker.slots_used) % tracker.slot_capacity;
+    frame->page_count = 0;
+    frame->complete = true;
+}
+
+bool snapshot_init(void* base, size_t size, int max_frames, size_t max_pages) {
+    memset(&tracker, 0, sizeof(tracker));
+    tracker.page_size = (size_t)sysconf(_SC_PAGESIZE);
+    if ((uintptr_t)base % tracker.page_size != 0 || size % tracker.page_size != 0 || max_frames < 1) {
+        printf("Snapshot region must be page aligned\n");
+        return false;
+    }
+
+    tracker.base = (unsigned char*)base;
+    tracker.size = size;
+    tracker.page_count = size / tracker.page_size;
+    tracker.slot_capacity = max_pages;
+    // Completed frames plus the one being recorded
+    tracker.frame_capacity = max_frames + 1;
+
+    tracker.slots = mmap(NULL, max_pages * tracker.page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    tracker.slot_pages = calloc(max_pages, sizeof(uint32_t));
+    tracker.frames = calloc((size_t)tracker.frame_capacity, sizeof(SnapshotFrame));
+    tracker.dirty = calloc(tracker.page_count, 1);
+    tracker.dirty_list = calloc(tracker.page_count, sizeof(uint32_t));
+    if (tracker.slots == MAP_FAILED || !tracker.slot_pages || !tracker.frames || !tracker.dirty || !tracker.dirty_list) {
+        printf("Failed to allocate snapshot history\n");
+        tracker.slots = NULL;
+        snapshot_shutdown();
+        return false;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = snapshot_fault_handler;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGSEGV, &action, &tracker.previous_action) != 0) {
+        printf("Failed to install snapshot fault handler: %s\n", strerror(errno));
+        snapshot_shutdown();
+        return false;
+    }
+    tracker.handler_installed = true;
+
+    begin_frame();
+    tracker.tracking = 1;
+    if (mprotect(tracker.base, tracker.size, PROT_READ) != 0) {
+        printf("Failed to write-protect snapshot region: %s\n", strerror(errno));
+        snapshot_shutdown();
+        return false;
+    }
+
+    printf("Snapshots: %d frames of history, up to %zu pages (%zu MB)\n",
+           max_frames, max_pages, (max_pages * tracker.page_size) >> 20);
+    return true;
+}
+
+bool snapshot_track(size_t size) {
+    size = (size + tracker.page_size - 1) / tracker.page_size * tracker.page_size;
+    if (!tracker.tracking || size <= tracker.size) {
+        return true;
+    }
+
+    size_t page_count = size / tracker.page_size;
+    unsigned char* dirty = realloc(tracker.dirty, page_count);
+    if (dirty) {
+        tracker.dirty = dirty;
+    }
+    uint32_t* dirty_list = realloc(tracker.dirty_list, page_count * sizeof(uint32_t));
+    if (dirty_list) {
+        tracker.dirty_list = dirty_list;
+    }
+    if (!dirty || !dirty_list) {
+        printf("Failed to grow snapshot tracking to %zu MB\n", size >> 20);
+        return false;
+    }
+    memset(tracker.dirty + tracker.page_count, 0, page_count - tracker.page_count);
+
+    if (mprotect(tracker.base + tracker.size, size - tracker.size, PROT_READ) != 0) {
+        printf("Failed to write-protect snapshot region: %s\n", strerror(errno));
+        return false;
+    }
+    tracker.size = size;
+    tracker.page_count = page_count;
+    return true;
+}
+
+size_t snapshot_tracked_size(void) {
+    return tracker.tracking ? tracker.size : 0;
+}
+
+void snapshot_next_frame(void) {
+    if (!tracker.tracking) {
+        return;
+    }
+    protect_dirty_pages();
+    begin_frame();
+}
+
+int snapshot_rewind(int frames) {
+    if (!tracker.tracking) {
+        return 0;
+    }
+
+    // Undo the current frame's writes first, then whole frames, newest first
+    tracker.tracking = 0;
+    mprotect(tracker.base, tracker.size, PROT_READ | PROT_WRITE);
+
+    int rewound = -1;
+    size_t pages_restored = 0;
+    while (rewound < frames && tracker.frame_count > 0) {
+        SnapshotFrame* frame = current_frame();
+        if (!frame->complete) {
+            break;
+        }
+        for (size_t i = frame->page_count; i > 0; i--) {
+            size_t slot = (frame->first_slot + i - 1) % tracker.slot_capacity;
+            memcpy(tracker.base + tracker.slot_pages[slot] * tracker.page_size,
+                   tracker.slots + slot * tracker.page_size, tracker.page_size);
+        }
+        pages_restored += frame->page_count;
+        tracker.slots_used -= frame->page_count;
+        tracker.frame_count--;
+        rewound++;
+    }
+
+    for (size_t i = 0; i < tracker.dirty_count; i++) {
+        tracker.dirty[tracker.dirty_list[i]] = 0;
+    }
+    tracker.dirty_count = 0;
+    if (tracker.frame_count == 0) {
+        tracker.slot_tail = 0;
+        tracker.slots_used = 0;
+    }
+
+    // Start a fresh frame on top of the restored state
+    begin_frame();
+    mprotect(tracker.base, tracker.size, PROT_READ);
+    tracker.tracking = 1;
+
+    if (rewound < 0) {
+        printf("Snapshot history was dropped this frame, cannot rewind\n");
+        return 0;
+    }
+    printf("Rewound %d frames (%zu pages restored)\n", rewound, pages_restored);
+    return rewound;
+}
+
+void snapshot_clear(void) {
+    if (tracker.tracking) {
+        drop_history();
+        // Reloaded code that reset the heap may have committed tracked pages
+        // again, which made them writable; protect the whole region again
+        mprotect(tracker.base, tracker.size, PROT_READ);
+    }
+}
+
+int snapshot_frame_count(void) {
+    return tracker.frame_count > 0 ? tracker.frame_count - 1 : 0;
+}
+
+void snapshot_shutdown(void) {
+    if (tracker.handler_installed) {
+        tracker.tracking = 0;
+        mprotect(tracker.base, tracker.size, PROT_READ | PROT_WRITE);
+        sigaction(SIGSEGV, &tracker.previous_action, NULL);
+    }
+    if (tracker.slots) {
+        munmap(tracker.slots, tracker.slot_capacity * tracker.page_size);
+    }
+    free(tracker.slot_pages);
+    free(tracker.frames);
+    free(tracker.dirty);
+    free(tracker.dirty_list);
+    memset(&tracker, 0, sizeof(tracker));
+}
@@ -0,0 +1,46 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+#include <stddef.h>
+#include <stdbool.h>
+
+// Frame-by-frame rewind of a memory region, for debugging and replay.
+// The region is kept read-only; the first write to a page in a frame faults,
+// the page's previous contents are copied into a ring of saved pages and the
+// page is made writable for the rest of the frame. A frame therefore costs
+// one fault and one page copy per page it changed, and rewinding copies
+// those pages back, newest first.
+//
+// Writes into the region from inside system calls (read() into it, say)
+// fail with EFAULT instead of faulting, so the region must only be written
+// from user code. Tracking works on base pages, so it splits huge pages.
+
+// Start tracking `size` bytes at `base` (page aligned), keeping up to
+// `max_frames` frames of history in at most `max_pages` saved pages.
+// Accesses past `size` are not handled and fault as usual.
+bool snapshot_init(void* base, size_t size, int max_frames, size_t max_pages);
+
+// Extend tracking to the first `size` bytes of the region, for regions that
+// grow by committing reserved pages. Pages committed during a frame are only
+// tracked from the next call, so call it between frames. Tracked pages must
+// stay committed: rewinding and shutting down make all of them writable.
+bool snapshot_track(size_t size);
+
+// Bytes from the start of the region that are tracked
+size_t snapshot_tracked_size(void);
+
+// Close the current frame and start recording the next one
+void snapshot_next_frame(void);
+
+// Restore the region to its state `frames` frames before the current frame
+// started. Returns how many frames were actually rewound.
+int snapshot_rewind(int frames);
+
+// Forget all history, e.g. when reloaded code no longer matches the data
+void snapshot_clear(void);
+
+// Number of completed frames that can be rewound
+int snapshot_frame_count(void);
+
+// Stop tracking and leave the region writable
+void snapshot_shutdown(void);
+#endif